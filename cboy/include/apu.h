@@ -0,0 +1,92 @@
+#ifndef APU_H
+#define APU_H
+#include <blip.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct CPU;
+
+#define APU_SAMPLE_RATE 48000
+#define FRAME_SEQUENCER_PERIOD 8192 /* 512 Hz */
+
+struct Envelope {
+  uint8_t volume;
+  uint8_t period;
+  uint8_t timer;
+  bool increase;
+};
+
+/* One of the two pulse channels, the first one with frequency sweep. */
+struct Pulse {
+  bool enabled;
+  bool dac;
+  uint8_t duty;
+  uint8_t step;
+  uint16_t frequency;
+  uint16_t length;
+  bool length_enable;
+  struct Envelope envelope;
+  uint64_t next_step; /* cycle of the next duty step */
+
+  bool sweep_enabled;
+  uint8_t sweep_timer;
+  uint16_t shadow;
+};
+
+struct Wave {
+  bool enabled;
+  bool dac;
+  uint8_t position;
+  uint8_t sample;
+  uint16_t frequency;
+  uint16_t length;
+  bool length_enable;
+  uint64_t next_step;
+};
+
+struct Noise {
+  bool enabled;
+  bool dac;
+  uint16_t lfsr;
+  uint16_t length;
+  bool length_enable;
+  struct Envelope envelope;
+  uint64_t next_step;
+};
+
+/* The APU runs lazily: apu_sync brings it up to the CPU's cycle counter,
+ * stepping each channel only at the cycles where its output changes and
+ * handing those changes to the blip buffers. It is synced before every
+ * sound register access, at each frame sequencer event and when samples
+ * are drained. */
+struct Apu {
+  uint8_t regs[0x30]; /* 0xFF10-0xFF3F as written, wave RAM at 0x20 */
+  bool power;
+
+  struct Pulse pulse[2];
+  struct Wave wave;
+  struct Noise noise;
+
+  uint64_t time;        /* cycle the channels have been run to */
+  uint64_t frame_start; /* cycle of the blip frame start */
+  uint8_t sequencer_step;
+
+  int16_t output[4][2]; /* last level handed to blip, per channel and side */
+  struct Blip blip[2];  /* left, right */
+};
+
+void apu_reset(struct CPU *cpu);
+void apu_sync(struct CPU *cpu);
+/* SCHED_APU handler, one per frame sequencer step. */
+void apu_event(struct CPU *cpu, uint64_t time);
+uint8_t apu_read(struct CPU *cpu, uint8_t reg);
+void apu_write(struct CPU *cpu, uint8_t reg, uint8_t val);
+
+/* Syncs and closes the current blip frame. run_frame calls this once per
+ * frame; samples nobody reads are dropped once half the buffer is full. */
+void apu_end_frame(struct CPU *cpu);
+uint32_t apu_samples_avail(struct CPU *cpu);
+/* Reads up to count interleaved stereo frames into out. */
+uint32_t apu_read_samples(struct CPU *cpu, int16_t *out, uint32_t count);
+
+#endif
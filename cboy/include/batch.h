@@ -0,0 +1,52 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <cartridge.h>
+#include <stdint.h>
+
+struct CPU;
+
+/* Many independent emulator instances run on a pool of worker threads, one
+ * per core by default. Each batch_run queues every loaded instance on the
+ * worker its affinity hint names; a worker whose queue runs dry steals
+ * from the others. Instances share nothing, so a worker runs an instance's
+ * frames back to back without locks. */
+struct Batch;
+
+struct BatchStats {
+  uint64_t frames; /* run_frame calls, summed over every instance */
+  uint64_t steals; /* instances run by a worker they were not queued on */
+  double seconds;  /* wall time spent inside batch_run */
+};
+
+/* workers 0 starts one per online core. Returns NULL when out of memory
+ * or when no worker thread could be started. */
+struct Batch *batch_create(uint32_t instances, uint32_t workers);
+void batch_destroy(struct Batch *batch);
+
+uint32_t batch_instances(const struct Batch *batch);
+uint32_t batch_workers(const struct Batch *batch);
+
+/* The instance itself, for input, render settings and reading results
+ * between batch_run calls. Never touch it while batch_run is running. */
+struct CPU *batch_instance(struct Batch *batch, uint32_t instance);
+
+/* Resets the instance with the given ROM. The ROM is not copied, many
+ * instances can share one mapping, and it must outlive the batch or the
+ * next load. Battery RAM stays in memory. */
+enum CartridgeError batch_load(struct Batch *batch, uint32_t instance,
+                               uint8_t *rom, uint32_t size);
+
+/* Queues the instance on this worker first, modulo the worker count.
+ * Defaults to instance % workers. Keeping the hint stable keeps an
+ * instance on a warm cache from one batch_run to the next. */
+void batch_set_affinity(struct Batch *batch, uint32_t instance,
+                        uint32_t worker);
+
+/* Runs frames frames on every loaded instance and returns when all are
+ * done. Must not be called from more than one thread at once. */
+void batch_run(struct Batch *batch, uint32_t frames);
+
+/* Totals since batch_create. */
+struct BatchStats batch_stats(const struct Batch *batch);
+
+#endif
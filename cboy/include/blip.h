@@ -0,0 +1,31 @@
+#ifndef BLIP_H
+#define BLIP_H
+#include <stdint.h>
+
+/* Band-limited step buffer. Amplitude changes are added as deltas at clock
+ * times inside the current frame, each spread over BLIP_WIDTH samples with
+ * a windowed sinc, and integrated into samples when read. Synthesis cost is
+ * per change, not per clock. */
+#define BLIP_WIDTH 16
+#define BLIP_PHASES 32
+#define BLIP_CAPACITY 4096 /* samples buffered before the oldest drop */
+
+struct Blip {
+  uint64_t factor; /* samples per clock, 32.32 fixed point */
+  uint64_t offset; /* start of the current frame in samples, 32.32 */
+  int32_t integrator;
+  int32_t buffer[BLIP_CAPACITY + BLIP_WIDTH];
+};
+
+void blip_init(struct Blip *blip, uint32_t clock_rate, uint32_t sample_rate);
+void blip_clear(struct Blip *blip);
+/* time is in clocks from the start of the current frame. */
+void blip_add_delta(struct Blip *blip, uint32_t time, int32_t delta);
+/* Makes the samples before time readable and starts the next frame there. */
+void blip_end_frame(struct Blip *blip, uint32_t time);
+uint32_t blip_samples_avail(const struct Blip *blip);
+/* Reads up to count samples into out, stride apart. NULL discards them. */
+uint32_t blip_read_samples(struct Blip *blip, int16_t *out, uint32_t count,
+                           uint32_t stride);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef BUS_H
+#define BUS_H
+#include <stdint.h>
+
+struct CPU;
+
+#define PAGE_SIZE 0x100
+#define PAGE_COUNT 0x100
+
+/* The 16-bit address space split into 256 byte pages. A page with a host
+ * pointer is accessed directly, a NULL page goes through bus_read_slow and
+ * bus_write_slow (mapper registers, unmapped cartridge RAM, OAM, IO
+ * registers, HRAM and IE, plus writes to VRAM tile data). */
+struct MemoryBus {
+  uint8_t *read_pages[PAGE_COUNT];
+  uint8_t *write_pages[PAGE_COUNT];
+  uint8_t vram[0x2000];
+  uint8_t wram[0x2000];
+  uint8_t oam[0xA0];
+  uint8_t io[0x80];
+  uint8_t hram[0x7F];
+  uint8_t ie;
+};
+
+/* Maps everything but the cartridge, see cartridge_init. */
+void bus_init(struct MemoryBus *bus);
+/* Points the VRAM, WRAM and unmapped pages at bus, leaving its contents
+ * alone. A bus copied from another instance still points into that one. */
+void bus_map_fixed(struct MemoryBus *bus);
+
+/* Points count pages starting at first_page into read_base and write_base,
+ * NULL sends the pages through the slow path. */
+void bus_map(struct MemoryBus *bus, uint8_t first_page, uint16_t count,
+             uint8_t *read_base, uint8_t *write_base);
+
+uint8_t bus_read_slow(struct CPU *cpu, uint16_t address);
+void bus_write_slow(struct CPU *cpu, uint16_t address, uint8_t val);
+
+#endif
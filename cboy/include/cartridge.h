@@ -0,0 +1,86 @@
+#ifndef CARTRIDGE_H
+#define CARTRIDGE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+struct CPU;
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+
+enum Mapper {
+  MAPPER_NONE,
+  MAPPER_MBC1,
+  MAPPER_MBC2,
+  MAPPER_MBC3,
+  MAPPER_MBC5,
+};
+
+enum CartridgeError {
+  CART_OK,
+  CART_OPEN,
+  CART_TOO_SMALL,
+  CART_BAD_CHECKSUM,
+  CART_UNSUPPORTED,
+  CART_ALLOC,
+  CART_SAVE,
+};
+
+struct File;
+
+/* The ROM image is never copied: bank switches repoint the 0x4000-0x7FFF
+ * (and for MBC1 mode 1, 0x0000-0x3FFF) bus pages into it, and the
+ * 0xA000-0xBFFF pages into the RAM image. */
+struct Cartridge {
+  uint8_t *rom;
+  uint32_t rom_size;
+  uint16_t rom_banks;
+  uint8_t *ram;
+  uint32_t ram_size;
+  uint8_t ram_banks;
+  uint8_t mapper; /* enum Mapper */
+  bool battery;
+  bool ram_saved; /* ram is a shared mapping of the save file */
+  bool ram_dirty;
+
+  bool ram_enabled;
+  uint16_t rom_bank;
+  uint8_t ram_bank;
+  uint8_t mbc1_bank2; /* MBC1 upper ROM bits / RAM bank */
+  uint8_t mbc1_mode;
+  uint8_t rtc[5];     /* MBC3 S, M, H, DL, DH as last latched */
+  uint8_t rtc_latch;
+};
+
+/* Maps a ROM file read only and validates its header, nothing is read or
+ * allocated for an invalid ROM. Unmap with cartridge_unmap_file. */
+enum CartridgeError cartridge_map_file(const char *path, struct File *rom);
+void cartridge_unmap_file(struct File *rom);
+
+/* Checks the header checksum, cartridge type and that the image holds the
+ * ROM size the header declares. */
+enum CartridgeError cartridge_check_header(const uint8_t *rom,
+                                           uint32_t size);
+
+/* Sizes the cartridge from its header, allocates exactly the RAM it
+ * declares and maps the initial banks. Battery backed RAM is a shared
+ * mapping of save_path instead, created if missing and never shrunk; a
+ * file of an unexpected size is copied to save_path.bak first. NULL keeps
+ * it in memory only. */
+enum CartridgeError cartridge_init(struct CPU *cpu, uint8_t *rom,
+                                   uint32_t size, const char *save_path);
+/* Maps the banks the mapper registers select, for a cartridge whose
+ * registers were restored rather than written. */
+void cartridge_remap(struct CPU *cpu);
+/* Writes saved RAM back if it changed since the last sync. Asynchronous
+ * unless wait is set, cheap enough for every frame boundary. */
+void cartridge_sync(struct Cartridge *cart, bool wait);
+/* Syncs and waits for saved RAM, then releases it. */
+void cartridge_free(struct Cartridge *cart);
+
+/* Slow path accesses: mapper registers in 0x0000-0x7FFF and cartridge RAM
+ * in 0xA000-0xBFFF when it is not mapped directly. */
+uint8_t cartridge_read(struct CPU *cpu, uint16_t address);
+void cartridge_write(struct CPU *cpu, uint16_t address, uint8_t val);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef CBOY_H
+#define CBOY_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Stable C interface of libcboy, for embedding the emulator in other
+ * languages and programs. Instances are opaque and independent, so any
+ * number can run on different threads; a single instance is not thread
+ * safe. Only fixed width types cross the interface. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The library is POSIX only (mmap, pthreads), so ELF visibility will do. */
+#define CBOY_API __attribute__((visibility("default")))
+
+/* Bumped on any incompatible change to this header. */
+#define CBOY_API_VERSION 1
+
+#define CBOY_SCREEN_WIDTH 160
+#define CBOY_SCREEN_HEIGHT 144
+#define CBOY_WRAM_SIZE 0x2000
+
+enum CboyError {
+  CBOY_OK = 0,
+  CBOY_ERROR_OPEN = 1,        /* ROM file missing or unreadable */
+  CBOY_ERROR_BAD_ROM = 2,     /* bad header or truncated image */
+  CBOY_ERROR_UNSUPPORTED = 3, /* mapper not emulated */
+  CBOY_ERROR_NO_MEMORY = 4,
+  CBOY_ERROR_NO_ROM = 5,      /* nothing loaded yet */
+  CBOY_ERROR_BAD_STATE = 6,   /* not a state for this ROM and version */
+  CBOY_ERROR_BUFFER = 7,      /* buffer smaller than cboy_state_size */
+};
+
+/* Bits for cboy_set_input. */
+enum CboyButton {
+  CBOY_BUTTON_RIGHT = 1 << 0,
+  CBOY_BUTTON_LEFT = 1 << 1,
+  CBOY_BUTTON_UP = 1 << 2,
+  CBOY_BUTTON_DOWN = 1 << 3,
+  CBOY_BUTTON_A = 1 << 4,
+  CBOY_BUTTON_B = 1 << 5,
+  CBOY_BUTTON_SELECT = 1 << 6,
+  CBOY_BUTTON_START = 1 << 7,
+};
+
+typedef struct Cboy Cboy;
+
+/* CBOY_API_VERSION of the library actually loaded. */
+CBOY_API uint32_t cboy_api_version(void);
+
+/* NULL when out of memory. */
+CBOY_API Cboy *cboy_create(void);
+CBOY_API void cboy_destroy(Cboy *cboy);
+
+/* Resets the instance with a new ROM. The buffer is copied, a file is
+ * mapped read only. Cartridge RAM is kept in memory, never written out. */
+CBOY_API int32_t cboy_load_rom(Cboy *cboy, const void *data, size_t size);
+CBOY_API int32_t cboy_load_rom_file(Cboy *cboy, const char *path);
+
+/* Runs until the next VBlank. */
+CBOY_API int32_t cboy_run_frame(Cboy *cboy);
+
+/* Buttons held from now on, a mask of enum CboyButton. */
+CBOY_API void cboy_set_input(Cboy *cboy, uint8_t buttons);
+
+/* Draws every interval-th frame, 0 draws none. 1 by default. */
+CBOY_API void cboy_set_render_interval(Cboy *cboy, uint8_t interval);
+
+/* Live views into the instance, valid until cboy_destroy and updated in
+ * place by cboy_run_frame. The framebuffer is CBOY_SCREEN_HEIGHT rows of
+ * CBOY_SCREEN_WIDTH shades, 0 (lightest) to 3. */
+CBOY_API const uint8_t *cboy_framebuffer(const Cboy *cboy);
+CBOY_API uint8_t *cboy_wram(Cboy *cboy);
+
+/* Save states into caller memory, a few microseconds either way. The size
+ * is fixed once a ROM is loaded and 0 before. States load into any
+ * instance running the same ROM with the same library build. The
+ * framebuffer is not part of a state and catches up on the next frame. */
+CBOY_API size_t cboy_state_size(const Cboy *cboy);
+CBOY_API int32_t cboy_save_state(const Cboy *cboy, void *buffer, size_t size);
+CBOY_API int32_t cboy_load_state(Cboy *cboy, const void *buffer,
+                                 size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,8 +1,17 @@
 #ifndef EMULATION_H
 #define EMULATION_H
-#include <cJSON.h>
+#include <apu.h>
+#include <bus.h>
+#include <cartridge.h>
+#include <joypad.h>
+#include <opcodes.h>
+#include <ppu.h>
+#include <scheduler.h>
+#include <serial.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <timer.h>
 
 union Register {
   uint16_t full;
@@ -19,15 +28,73 @@ struct Registers {
   uint16_t PC;
 };
 
-struct MemoryBus {
-  uint8_t *memory;
-};
-
+/* Ordered for save states: the bus page tables lead and the APU's blip
+ * buffers trail, so everything from bus.vram up to apu.blip is machine
+ * state and is saved in one copy, see state.c. */
 struct CPU {
-  struct Registers registers;
   struct MemoryBus bus;
+  struct Registers registers;
+  struct Cartridge cart;
+  struct Timer timer;
+  struct Serial serial;
+  struct Joypad joypad;
+  struct Scheduler scheduler;
+  bool ime;
+  bool ime_pending; /* EI takes effect after the next instruction */
+  bool halted;
+  bool halt_bug;
+  uint64_t cycles;      /* T-cycles since reset */
+  uint64_t idle_cycles; /* of those, skipped in HALT and idle loops */
+  uint8_t events;       /* enum CpuEvent, cleared by cpu_run */
+  struct Ppu ppu;
+  struct Apu apu;
+  struct Screen screen;
 };
 
+#define CLOCK_SPEED 4194304
+#define CYCLES_PER_FRAME 70224
+
+/* Reasons for cpu_run to return before its budget is used up. */
+enum CpuEvent {
+  EVENT_VBLANK = 1 << 0,
+};
+
+#define IF_ADDRESS 0xFF0F
+#define IE_ADDRESS 0xFFFF
+
+enum Interrupt {
+  INT_VBLANK = 1 << 0,
+  INT_STAT = 1 << 1,
+  INT_TIMER = 1 << 2,
+  INT_SERIAL = 1 << 3,
+  INT_JOYPAD = 1 << 4,
+};
+
+static inline uint8_t bus_read(struct CPU *cpu, uint16_t address) {
+  const uint8_t *page = cpu->bus.read_pages[address >> 8];
+  if (page != NULL) {
+    return page[address & 0xFF];
+  }
+  return bus_read_slow(cpu, address);
+}
+
+static inline void bus_write(struct CPU *cpu, uint16_t address, uint8_t val) {
+  uint8_t *page = cpu->bus.write_pages[address >> 8];
+  if (page != NULL) {
+    page[address & 0xFF] = val;
+    return;
+  }
+  bus_write_slow(cpu, address, val);
+}
+
+static inline uint8_t interrupts_pending(struct CPU *cpu) {
+  return cpu->bus.ie & cpu->bus.io[IF_ADDRESS & 0x7F] & 0x1F;
+}
+
+static inline void request_interrupt(struct CPU *cpu, enum Interrupt interrupt) {
+  cpu->bus.io[IF_ADDRESS & 0x7F] |= interrupt;
+}
+
 struct RAM {
   uint16_t size;
   void *buffer;
@@ -38,70 +105,31 @@ struct File {
   uint32_t size;
 };
 
-enum OperandType {
-  NONE = 0,
-  r8 = 1 << 0,
-  r16 = 1 << 1,
-  n8 = 1 << 2,
-  n16 = 1 << 3,
-  e8 = 1 << 4,
-  u3 = 1 << 5,
-  cc = 1 << 6,
-  vec = 1 << 7,
-  R_A = 1 << 8,
-  R_B = 1 << 9,
-  R_C = 1 << 10,
-  R_D = 1 << 11,
-  R_E = 1 << 12,
-  R_H = 1 << 13,
-  R_L = 1 << 14,
-  R_BC = 1 << 15,
-  R_DE = 1 << 16,
-  R_HL = 1 << 17,
-  Z = 1 << 18,
-  NZ = 1 << 19,
-  C = 1 << 20,
-  NC = 1 << 21
-};
-
+/* Decoded form of an instruction, only used for tracing. */
 struct Instruction {
-  char *mnemonic;
-  bool *immediate;
-  uint8_t *cycles;
-  uint8_t bytes;
-  uint8_t cycle_count;
-  uint8_t operand_count;
-  struct Operand {
-    enum OperandType type;
-    bool *immediate;
-    uint8_t *bytes;
-    int8_t *increment;
-    void *address;
-  } *operands;
-  struct Flags {
-    char *Z;
-    char *N;
-    char *H;
-    char *C;
-  } *flags;
+  const struct OpcodeInfo *info;
   struct Opcode {
     bool prefixed;
     uint8_t val;
-    char *id;
-  } *opcode;
-};
-struct OperandTable {
-  char *id;
-  enum OperandType operand;
+  } opcode;
+  uint16_t imm; /* n8/n16/a8/a16/e8 operand, if any */
 };
 
 /*void log_opcode(const struct Opcode *opcode);*/
 /*void log_instruction(const struct Instruction *instruction);*/
-/*uint8_t get_opcode(struct File *rom, struct Opcode *opcode, uint32_t
- * *read_index);*/
-/*int serialize_instruction(struct Instruction *instruction, cJSON *json);*/
-/*void jump(struct CPU *cpu, const enum Conditions *condition, const uint16_t
- * n16);*/
-int cpu_step(struct CPU *cpu, cJSON *json);
+
+void cpu_reset(struct CPU *cpu);
+
+/* Executes one instruction or services one interrupt. Returns the T-cycles
+ * it took, including any fast-forwarded in HALT or an idle loop. */
+int cpu_step(struct CPU *cpu);
+
+/* Runs until cycle_budget T-cycles are used up or a CpuEvent fires,
+ * whichever comes first. Returns the T-cycles actually consumed, which may overshoot
+ * the budget by the length of the last instruction. */
+uint32_t cpu_run(struct CPU *cpu, uint32_t cycle_budget);
+
+/* Runs until the next VBlank. Returns the T-cycles consumed. */
+uint32_t run_frame(struct CPU *cpu);
 
 #endif
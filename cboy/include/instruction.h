@@ -2,8 +2,13 @@
 #define INSTRUCTION_H
 #include <emulation.h>
 
-void ld(struct Instruction *instruction, struct CPU *cpu);
-void ldh(struct Instruction *instruction, struct CPU *cpu);
-void jp(struct Instruction *instruction, struct CPU *cpu);
+/* Fetches, decodes and executes the instruction at PC. Returns T-cycles. */
+uint8_t execute(struct CPU *cpu);
+
+/* Called by a taken short backward JR at address jr, before its cycles are
+ * counted. If PC now heads a loop that only polls memory nothing but an
+ * event can change, the iterations that end before the next event are
+ * skipped. */
+void skip_idle_loop(struct CPU *cpu, uint16_t jr);
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef JOYPAD_H
+#define JOYPAD_H
+#include <stdint.h>
+
+struct CPU;
+
+enum Button {
+  BUTTON_RIGHT = 1 << 0,
+  BUTTON_LEFT = 1 << 1,
+  BUTTON_UP = 1 << 2,
+  BUTTON_DOWN = 1 << 3,
+  BUTTON_A = 1 << 4,
+  BUTTON_B = 1 << 5,
+  BUTTON_SELECT = 1 << 6,
+  BUTTON_START = 1 << 7,
+};
+
+struct Joypad {
+  uint8_t pressed; /* enum Button */
+};
+
+/* Presses and releases buttons, raising the joypad interrupt on a press. */
+void joypad_set(struct CPU *cpu, uint8_t pressed);
+uint8_t joypad_read(struct CPU *cpu, uint8_t reg);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+#include <cartridge.h>
+#include <stdint.h>
+
+struct CPU;
+
+/* Experimental core for many copies of one ROM run side by side. The
+ * register files of up to LOCKSTEP_MAX_LANES instances are kept as one
+ * array per register. Lanes at the same PC on the same ROM bank take a
+ * register-only instruction together, through one lane kernel call.
+ * Anything else, and every lane that has wandered off, goes through
+ * cpu_step one lane at a time. Each lane still has its own struct CPU for
+ * memory and peripherals, and ends up exactly where run_frame would. */
+
+#define LOCKSTEP_MAX_LANES 32
+
+/* Register indices follow the 3 bit operand encoding, with F in the slot
+ * of (HL). Pairs are named by their high register. */
+enum LaneRegister {
+  LANE_B,
+  LANE_C,
+  LANE_D,
+  LANE_E,
+  LANE_H,
+  LANE_L,
+  LANE_F,
+  LANE_A,
+  LANE_SP, /* 16-bit operands only */
+  LANE_IMM,
+};
+
+/* Instructions a lane kernel can run, as classified from opcode_table. */
+enum LaneOpKind {
+  LANE_SCALAR, /* needs memory, IME or the idle loop check */
+  LANE_NOP,
+  LANE_LD8,
+  LANE_LD16,
+  LANE_INC8,
+  LANE_DEC8,
+  LANE_INC16,
+  LANE_DEC16,
+  LANE_ADD,
+  LANE_ADC,
+  LANE_SUB,
+  LANE_SBC,
+  LANE_AND,
+  LANE_XOR,
+  LANE_OR,
+  LANE_CP,
+  LANE_CPL,
+  LANE_SCF,
+  LANE_CCF,
+  LANE_RLCA,
+  LANE_RRCA,
+  LANE_RLA,
+  LANE_RRA,
+  LANE_JP,
+  LANE_JR,
+};
+
+struct LaneOp {
+  uint8_t kind; /* enum LaneOpKind */
+  uint8_t dst;  /* enum LaneRegister */
+  uint8_t src;  /* enum LaneRegister */
+  uint8_t cond; /* enum OperandName, OP_NONE for unconditional */
+  uint8_t bytes;
+  uint8_t cycles;
+  uint8_t cycles_not_taken;
+};
+
+/* Lane state the kernels work on. Entries past the lane count are never
+ * part of a mask but are there so kernels can use whole vectors. */
+struct LaneState {
+  _Alignas(32) uint8_t r[8][LOCKSTEP_MAX_LANES]; /* enum LaneRegister */
+  _Alignas(32) uint16_t sp[LOCKSTEP_MAX_LANES];
+  _Alignas(32) uint16_t pc[LOCKSTEP_MAX_LANES];
+  _Alignas(32) uint64_t cycles[LOCKSTEP_MAX_LANES];
+  _Alignas(32) uint64_t next[LOCKSTEP_MAX_LANES]; /* scheduler.next */
+};
+
+/* Every implementation gives identical results, lane_kernels picks the
+ * widest one the host CPU supports. */
+struct LaneKernels {
+  const char *name;
+  /* The lanes in mask whose PC is pc. */
+  uint32_t (*match_pc)(const struct LaneState *lanes, uint32_t mask,
+                       uint16_t pc);
+  /* Runs op on the lanes in mask, which all share one PC, and adds its
+   * cycles. imm is the n8/n16/e8 operand. Returns the lanes whose next
+   * event is now due. */
+  uint32_t (*execute)(struct LaneState *lanes, uint32_t mask,
+                      const struct LaneOp *op, uint16_t imm);
+};
+
+extern const struct LaneKernels lane_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct LaneKernels lane_kernels_avx2;
+#endif
+
+const struct LaneKernels *lane_kernels(void);
+
+struct LockstepStats {
+  uint64_t steps;               /* a group of lanes at one PC stepped */
+  uint64_t vector_steps;        /* of those, run by the lane kernel */
+  uint64_t vector_instructions; /* lane instructions the kernel ran */
+  uint64_t scalar_instructions; /* lane instructions run through cpu_step */
+  uint64_t lane_slots;          /* active lanes, summed over every step */
+  uint64_t divergent_steps;     /* steps that left an active lane behind */
+};
+
+struct Lockstep;
+
+/* lanes is 1 to LOCKSTEP_MAX_LANES, 8, 16 or 32 fill whole vectors. */
+struct Lockstep *lockstep_create(uint32_t lanes);
+void lockstep_destroy(struct Lockstep *lockstep);
+
+/* Resets every lane with the same ROM. Lanes only run together while they
+ * read code through the same mapping, so the ROM is shared, not copied,
+ * and must outlive the lockstep or the next load. */
+enum CartridgeError lockstep_load(struct Lockstep *lockstep, uint8_t *rom,
+                                  uint32_t size);
+
+/* The lane's instance, up to date between lockstep_run_frame calls. */
+struct CPU *lockstep_lane(struct Lockstep *lockstep, uint32_t lane);
+uint32_t lockstep_lanes(const struct Lockstep *lockstep);
+
+void lockstep_use_kernels(struct Lockstep *lockstep,
+                          const struct LaneKernels *kernels);
+
+/* run_frame on every lane. */
+void lockstep_run_frame(struct Lockstep *lockstep);
+
+/* Totals since lockstep_create. */
+struct LockstepStats lockstep_stats(const struct Lockstep *lockstep);
+
+#endif
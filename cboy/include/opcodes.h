@@ -0,0 +1,132 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+#include <stdint.h>
+
+/* Mnemonics as they appear in opcodes.json. The list is shared between the
+ * enum below, the name table and the table generator. */
+#define MNEMONICS(X)                                                           \
+  X(NOP)                                                                       \
+  X(LD)                                                                        \
+  X(LDH)                                                                       \
+  X(INC)                                                                       \
+  X(DEC)                                                                       \
+  X(ADD)                                                                       \
+  X(ADC)                                                                       \
+  X(SUB)                                                                       \
+  X(SBC)                                                                       \
+  X(AND)                                                                       \
+  X(XOR)                                                                       \
+  X(OR)                                                                        \
+  X(CP)                                                                        \
+  X(RLCA)                                                                      \
+  X(RRCA)                                                                      \
+  X(RLA)                                                                       \
+  X(RRA)                                                                       \
+  X(DAA)                                                                       \
+  X(CPL)                                                                       \
+  X(SCF)                                                                       \
+  X(CCF)                                                                       \
+  X(STOP)                                                                      \
+  X(HALT)                                                                      \
+  X(JR)                                                                        \
+  X(JP)                                                                        \
+  X(CALL)                                                                      \
+  X(RET)                                                                       \
+  X(RETI)                                                                      \
+  X(RST)                                                                       \
+  X(PUSH)                                                                      \
+  X(POP)                                                                       \
+  X(DI)                                                                        \
+  X(EI)                                                                        \
+  X(PREFIX)                                                                    \
+  X(RLC)                                                                       \
+  X(RRC)                                                                       \
+  X(RL)                                                                        \
+  X(RR)                                                                        \
+  X(SLA)                                                                       \
+  X(SRA)                                                                       \
+  X(SWAP)                                                                      \
+  X(SRL)                                                                       \
+  X(BIT)                                                                       \
+  X(RES)                                                                       \
+  X(SET)                                                                       \
+  X(ILLEGAL)
+
+/* Operand names. Registers, immediates, conditions, bit indices (u3) and
+ * restart vectors. "C" is emitted as COND_C when it is a branch condition. */
+#define OPERANDS(X)                                                            \
+  X(NONE, "")                                                                  \
+  X(A, "A")                                                                    \
+  X(B, "B")                                                                    \
+  X(C, "C")                                                                    \
+  X(D, "D")                                                                    \
+  X(E, "E")                                                                    \
+  X(H, "H")                                                                    \
+  X(L, "L")                                                                    \
+  X(AF, "AF")                                                                  \
+  X(BC, "BC")                                                                  \
+  X(DE, "DE")                                                                  \
+  X(HL, "HL")                                                                  \
+  X(SP, "SP")                                                                  \
+  X(N8, "n8")                                                                  \
+  X(N16, "n16")                                                                \
+  X(A8, "a8")                                                                  \
+  X(A16, "a16")                                                                \
+  X(E8, "e8")                                                                  \
+  X(U3, "u3")                                                                  \
+  X(VEC, "vec")                                                                \
+  X(COND_Z, "Z")                                                               \
+  X(COND_NZ, "NZ")                                                             \
+  X(COND_C, "C")                                                               \
+  X(COND_NC, "NC")
+
+#define MNEMONIC_ENUM(name) MN_##name,
+enum Mnemonic { MNEMONICS(MNEMONIC_ENUM) MN_COUNT };
+#undef MNEMONIC_ENUM
+
+#define OPERAND_ENUM(name, str) OP_##name,
+enum OperandName { OPERANDS(OPERAND_ENUM) OP_COUNT };
+#undef OPERAND_ENUM
+
+enum OperandFlags {
+  OPF_INDIRECT = 1 << 0,  /* (HL), (a16), ... */
+  OPF_INCREMENT = 1 << 1, /* (HL+) or SP+e8 */
+  OPF_DECREMENT = 1 << 2, /* (HL-) */
+};
+
+/* Two bits per flag, Z in the top pair down to C in the bottom pair. */
+enum FlagEffect {
+  FLAG_UNCHANGED = 0,
+  FLAG_RESET = 1,
+  FLAG_SET = 2,
+  FLAG_AFFECTED = 3
+};
+
+#define FLAG_EFFECT_Z(effects) (((effects) >> 6) & 3)
+#define FLAG_EFFECT_N(effects) (((effects) >> 4) & 3)
+#define FLAG_EFFECT_H(effects) (((effects) >> 2) & 3)
+#define FLAG_EFFECT_C(effects) ((effects) & 3)
+
+struct OperandInfo {
+  uint8_t name;  /* enum OperandName */
+  uint8_t flags; /* enum OperandFlags */
+  uint8_t value; /* bit index for U3, address for VEC */
+};
+
+struct OpcodeInfo {
+  uint8_t mnemonic; /* enum Mnemonic */
+  uint8_t bytes;    /* including the 0xCB prefix */
+  uint8_t cycles;   /* T-cycles, branch taken */
+  uint8_t cycles_not_taken;
+  uint8_t flags; /* enum FlagEffect, packed */
+  uint8_t operand_count;
+  struct OperandInfo operands[3];
+};
+
+/* Indexed by opcode, CB-prefixed opcodes live at 0x100 + opcode.
+ * Generated at build time from opcodes.json by gen_opcodes. */
+extern const struct OpcodeInfo opcode_table[512];
+extern const char *const mnemonic_names[MN_COUNT];
+extern const char *const operand_names[OP_COUNT];
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+#include <stdint.h>
+
+/* A sprite pixel in the line buffer: color index, palette and priority. */
+#define OBJ_COLOR 0x03
+#define OBJ_PALETTE 0x04
+#define OBJ_BEHIND 0x08
+
+/* The PPU's pixel kernels. Every implementation gives identical output,
+ * pixel_kernels picks the widest one the host CPU supports. */
+struct PixelKernels {
+  const char *name;
+  /* 16 bytes of 2bpp tile data to 8x8 color indices. */
+  void (*decode_tile)(const uint8_t *data, uint8_t out[8][8]);
+  /* Applies BGP/OBP0/OBP1 and sprite priority to a 160 pixel line of
+   * background color indices and sprite pixels, writing shades 0-3. */
+  void (*compose_line)(const uint8_t *bg, const uint8_t *obj, uint8_t bgp,
+                       uint8_t obp0, uint8_t obp1, uint8_t *out);
+};
+
+extern const struct PixelKernels pixel_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct PixelKernels pixel_kernels_sse2;
+extern const struct PixelKernels pixel_kernels_avx2;
+#endif
+
+const struct PixelKernels *pixel_kernels(void);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PPU_H
+#define PPU_H
+#include <stdbool.h>
+#include <stdint.h>
+
+struct CPU;
+struct PixelKernels;
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+#define TILE_COUNT 384 /* 0x8000-0x97FF */
+
+#define DOTS_PER_LINE 456
+#define LINES_PER_FRAME 154
+
+enum PpuMode {
+  PPU_HBLANK,
+  PPU_VBLANK,
+  PPU_OAM_SCAN,
+  PPU_DRAWING,
+};
+
+enum Lcdc {
+  LCDC_BG_ENABLE = 1 << 0,
+  LCDC_OBJ_ENABLE = 1 << 1,
+  LCDC_OBJ_TALL = 1 << 2,
+  LCDC_BG_MAP = 1 << 3,
+  LCDC_TILE_DATA = 1 << 4,
+  LCDC_WINDOW_ENABLE = 1 << 5,
+  LCDC_WINDOW_MAP = 1 << 6,
+  LCDC_ENABLE = 1 << 7,
+};
+
+/* Scanline renderer. A line is drawn in one go when it enters mode 3, which
+ * is as exact as anything short of a pixel FIFO gets for mid-line writes.
+ * The framebuffer holds shades 0 (white) to 3 (black) after BGP/OBPn. */
+struct Ppu {
+  uint8_t lcdc;
+  uint8_t stat; /* interrupt selects, mode and coincidence are derived */
+  uint8_t scy;
+  uint8_t scx;
+  uint8_t ly;
+  uint8_t lyc;
+  uint8_t bgp;
+  uint8_t obp0;
+  uint8_t obp1;
+  uint8_t wy;
+  uint8_t wx;
+
+  uint8_t mode;        /* enum PpuMode */
+  uint8_t window_line; /* window rows drawn this frame */
+  uint8_t line;        /* current line, also counts while the LCD is off */
+  uint8_t stat_line;   /* STAT interrupt fires on its rising edge */
+  bool dma;            /* OAM DMA running, OAM is off limits to the CPU */
+};
+
+/* What the PPU draws and what it draws with. None of it is machine state:
+ * the tile cache is rebuilt from VRAM and the rest belongs to the host. */
+struct Screen {
+  /* Render skipping keeps all timing and interrupts, only the pixel work of
+   * skipped frames is dropped and their framebuffer keeps the old image. */
+  uint8_t render_interval; /* 1 renders every frame, N every Nth, 0 none */
+  uint8_t render_count;    /* frames since the last rendered one */
+  bool rendering;          /* the current frame is drawn */
+
+  /* Tiles decoded to color indices, redone lazily after a VRAM write. */
+  const struct PixelKernels *kernels; /* chosen once from CPUID */
+  uint8_t tiles[TILE_COUNT][8][8];
+  uint8_t tile_dirty[TILE_COUNT];
+
+  uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+};
+
+void ppu_reset(struct CPU *cpu);
+/* SCHED_PPU handler, one per mode change. Raises EVENT_VBLANK when a frame
+ * ends. */
+void ppu_event(struct CPU *cpu, uint64_t time);
+/* SCHED_DMA handler. */
+void ppu_dma_event(struct CPU *cpu, uint64_t time);
+/* Takes effect from the next frame. */
+void ppu_set_render_interval(struct CPU *cpu, uint8_t interval);
+/* Tile data writes, which are kept off the direct bus pages. */
+void ppu_write_vram(struct CPU *cpu, uint16_t address, uint8_t val);
+/* Decodes every tile again on next use, after VRAM changed behind the
+ * PPU's back. */
+void ppu_invalidate_tiles(struct CPU *cpu);
+uint8_t ppu_read(struct CPU *cpu, uint8_t reg);
+void ppu_write(struct CPU *cpu, uint8_t reg, uint8_t val);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef REWIND_H
+#define REWIND_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct CPU;
+
+/* Hold-to-rewind history. Every frame's save state, with the framebuffer
+ * it showed, is kept as the XOR against the frame after it, run-length
+ * coded into one fixed ring of bytes. Only the newest snapshot is kept
+ * whole, so stepping back decodes one delta into it and loads the result.
+ * When the ring or the frame limit is full the oldest frames go. Nothing
+ * is allocated after rewind_create. */
+struct Rewind;
+
+struct RewindStats {
+  uint32_t frames; /* frames rewind_step can go back */
+  size_t used;     /* ring bytes holding them */
+  size_t capacity;
+};
+
+/* A history for cpu's cartridge, at most frames deep and bytes big, e.g.
+ * 3600 frames in 64 MiB for a minute. bytes must hold at least one
+ * uncompressible frame; NULL if it does not or when out of memory. */
+struct Rewind *rewind_create(const struct CPU *cpu, size_t bytes,
+                             uint32_t frames);
+void rewind_destroy(struct Rewind *rewind);
+
+/* Records the frame just run, call it after every run_frame. */
+void rewind_push(struct Rewind *rewind, const struct CPU *cpu);
+
+/* Puts cpu and its framebuffer back one frame and forgets the frame it
+ * left. false, with cpu untouched, when the history is used up. */
+bool rewind_step(struct Rewind *rewind, struct CPU *cpu);
+
+/* Forgets everything, e.g. after loading a state or another ROM. */
+void rewind_clear(struct Rewind *rewind);
+
+struct RewindStats rewind_stats(const struct Rewind *rewind);
+
+#endif
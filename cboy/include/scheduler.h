@@ -0,0 +1,41 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <stdint.h>
+
+struct CPU;
+
+/* Everything that happens at a known cycle. Each kind has at most one
+ * pending event, scheduling it again moves it. */
+enum EventKind {
+  SCHED_PPU,    /* next PPU mode change */
+  SCHED_TIMER,  /* next TIMA increment */
+  SCHED_SERIAL, /* transfer complete */
+  SCHED_DMA,    /* OAM DMA complete */
+  SCHED_APU,    /* next frame sequencer step */
+  SCHED_KINDS,
+};
+
+#define SCHED_NEVER UINT64_MAX
+
+struct ScheduledEvent {
+  uint64_t time; /* absolute, in T-cycles since reset */
+  uint8_t kind;  /* enum EventKind */
+};
+
+/* Binary min-heap on time. The CPU runs until cycles reaches next, so the
+ * interpreter loop compares against one value whatever is pending. */
+struct Scheduler {
+  uint64_t next; /* time of the earliest event, SCHED_NEVER if none */
+  struct ScheduledEvent heap[SCHED_KINDS];
+  uint8_t slot[SCHED_KINDS]; /* heap index + 1 per kind, 0 if not pending */
+  uint8_t size;
+};
+
+void scheduler_reset(struct CPU *cpu);
+void schedule(struct CPU *cpu, enum EventKind kind, uint64_t time);
+void unschedule(struct CPU *cpu, enum EventKind kind);
+/* Fires every event due by cpu->cycles in time order. Handlers get the
+ * cycle they were scheduled for, which may be a few cycles behind. */
+void scheduler_run(struct CPU *cpu);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+#include <stdint.h>
+
+struct CPU;
+
+/* Link port without a partner. Bytes the game shifts out with the internal
+ * clock are handed to out, if set, once the eight bits have gone out. */
+struct Serial {
+  uint8_t sb;
+  uint8_t sc;
+  void (*out)(void *user, uint8_t byte);
+  void *user;
+};
+
+uint8_t serial_read(struct CPU *cpu, uint8_t reg);
+void serial_write(struct CPU *cpu, uint8_t reg, uint8_t val);
+/* SCHED_SERIAL handler. */
+void serial_event(struct CPU *cpu, uint64_t time);
+
+#endif
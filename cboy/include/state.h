@@ -0,0 +1,38 @@
+#ifndef STATE_H
+#define STATE_H
+#include <stddef.h>
+#include <stdint.h>
+
+struct CPU;
+
+/* Save states are a 24 byte header, the machine and the cartridge RAM:
+ * registers, WRAM, HRAM, VRAM, OAM, IO, mapper, timer, serial, joypad,
+ * scheduler queue, PPU and APU. The machine is one contiguous range of
+ * struct CPU, so saving and loading are a couple of memcpy calls into a
+ * buffer of state_size bytes, about 17 KiB plus the cartridge RAM.
+ *
+ * Left out and rebuilt on load: the bus page tables, the decoded tile
+ * cache and pending audio samples. The framebuffer and render interval
+ * are the host's and are kept, as are the ROM, the RAM backing and the
+ * serial callback, so a state can move between instances of the same ROM.
+ * The machine is stored in host byte order and struct layout; a build with
+ * another layout rejects it as STATE_BAD_VERSION. */
+
+#define STATE_VERSION 2
+
+enum StateError {
+  STATE_OK,
+  STATE_TOO_SMALL, /* buffer shorter than state_size */
+  STATE_BAD_MAGIC,
+  STATE_BAD_VERSION,
+  STATE_OTHER_ROM, /* saved from a different cartridge */
+};
+
+/* Bytes state_save writes, fixed for a loaded cartridge. */
+size_t state_size(const struct CPU *cpu);
+
+enum StateError state_save(const struct CPU *cpu, void *buffer, size_t size);
+/* Leaves cpu untouched unless the state is valid for its cartridge. */
+enum StateError state_load(struct CPU *cpu, const void *buffer, size_t size);
+
+#endif
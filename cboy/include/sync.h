@@ -0,0 +1,124 @@
+#ifndef SYNC_H
+#define SYNC_H
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Lock-free structures for one producer and one consumer thread. */
+
+#define CACHE_LINE 64
+
+/* Three buffer indices: the writer fills back, the reader shows front and
+ * the third sits in shared. Publishing swaps back with shared, acquiring
+ * swaps front with shared if it holds a fresh buffer, so neither side ever
+ * waits and the reader always gets the newest complete buffer. */
+#define TRIPLE_FRESH 0x4
+
+struct TripleBuffer {
+  alignas(CACHE_LINE) _Atomic uint8_t shared;
+  alignas(CACHE_LINE) uint8_t back;
+  alignas(CACHE_LINE) uint8_t front;
+};
+
+static inline void triple_init(struct TripleBuffer *tb) {
+  atomic_init(&tb->shared, 1);
+  tb->back = 0;
+  tb->front = 2;
+}
+
+/* Hands the filled back buffer over, returns the next one to fill. */
+static inline uint8_t triple_publish(struct TripleBuffer *tb) {
+  tb->back = atomic_exchange_explicit(&tb->shared, tb->back | TRIPLE_FRESH,
+                                      memory_order_acq_rel) &
+             (TRIPLE_FRESH - 1);
+  return tb->back;
+}
+
+/* Moves front to the newest published buffer, false if there is none. */
+static inline bool triple_acquire(struct TripleBuffer *tb) {
+  if (!(atomic_load_explicit(&tb->shared, memory_order_relaxed) &
+        TRIPLE_FRESH)) {
+    return false;
+  }
+  tb->front = atomic_exchange_explicit(&tb->shared, tb->front,
+                                       memory_order_acq_rel) &
+              (TRIPLE_FRESH - 1);
+  return true;
+}
+
+/* Byte ring over caller owned storage, capacity a power of two. head and
+ * tail count bytes forever, so full and empty need no spare slot. */
+struct SpscRing {
+  alignas(CACHE_LINE) _Atomic uint32_t head; /* written by producer */
+  alignas(CACHE_LINE) _Atomic uint32_t tail; /* written by consumer */
+  alignas(CACHE_LINE) uint8_t *data;
+  uint32_t mask;
+};
+
+static inline void spsc_init(struct SpscRing *ring, uint8_t *data,
+                             uint32_t capacity) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->data = data;
+  ring->mask = capacity - 1;
+}
+
+static inline uint32_t spsc_used(struct SpscRing *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static inline uint32_t spsc_free(struct SpscRing *ring) {
+  return ring->mask + 1 - spsc_used(ring);
+}
+
+/* Bytes of size that fit before the end of the storage. */
+static inline uint32_t spsc_span(const struct SpscRing *ring, uint32_t at,
+                                 uint32_t size) {
+  const uint32_t room = ring->mask + 1 - at;
+  return size < room ? size : room;
+}
+
+/* Copies size bytes in whole or not at all. */
+static inline bool spsc_write(struct SpscRing *ring, const void *src,
+                              uint32_t size) {
+  const uint32_t head =
+      atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const uint32_t tail =
+      atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (ring->mask + 1 - (head - tail) < size) {
+    return false;
+  }
+
+  const uint32_t at = head & ring->mask;
+  const uint32_t first = spsc_span(ring, at, size);
+  memcpy(ring->data + at, src, first);
+  memcpy(ring->data, (const uint8_t *)src + first, size - first);
+  atomic_store_explicit(&ring->head, head + size, memory_order_release);
+  return true;
+}
+
+/* Copies up to size bytes out, returns how many. */
+static inline uint32_t spsc_read(struct SpscRing *ring, void *dst,
+                                 uint32_t size) {
+  const uint32_t tail =
+      atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const uint32_t head =
+      atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  if (size > head - tail) {
+    size = head - tail;
+  }
+
+  const uint32_t at = tail & ring->mask;
+  const uint32_t first = spsc_span(ring, at, size);
+  memcpy(dst, ring->data + at, first);
+  memcpy((uint8_t *)dst + first, ring->data, size - first);
+  atomic_store_explicit(&ring->tail, tail + size, memory_order_release);
+  return size;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <stdint.h>
+
+struct CPU;
+
+/* Nothing runs per cycle. The internal counter is the cycles since it was
+ * last reset, TIMA is brought up to date from it when it is read or the
+ * registers change, and the only event is the next TIMA overflow. */
+struct Timer {
+  uint64_t div_reset; /* cycle of the last DIV write */
+  uint64_t synced;    /* cycle TIMA was last brought up to date */
+  uint8_t tima;
+  uint8_t tma;
+  uint8_t tac;
+};
+
+void timer_reset(struct CPU *cpu);
+/* SCHED_TIMER handler, at the cycle TIMA overflows. */
+void timer_event(struct CPU *cpu, uint64_t time);
+uint8_t timer_read(struct CPU *cpu, uint8_t reg);
+void timer_write(struct CPU *cpu, uint8_t reg, uint8_t val);
+
+#endif
@@ -0,0 +1,78 @@
+#include <emulation.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Allocation counting build. Linked with --wrap for malloc, calloc, realloc
+ * and free, it runs a ROM for N frames and fails if the emulation loop
+ * touches the heap once initialisation is done.
+ * Usage: cboy-alloc-check <rom.gb> [frames] */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static bool counting = false;
+static uint64_t allocations = 0;
+static uint64_t frees = 0;
+
+void *__wrap_malloc(size_t size) {
+  allocations += counting;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocations += counting;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocations += counting;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+  frees += counting && ptr != NULL;
+  __real_free(ptr);
+}
+
+int main(const int argc, char *argv[]) {
+  enum Errors { OK, WRONG_ARG, READ_FILE, ALLOCATED };
+  if (argc < 2 || argc > 3) {
+    printf("usage: cboy-alloc-check <rom.gb> [frames]\n");
+    return WRONG_ARG;
+  }
+  const uint32_t frames = argc == 3 ? (uint32_t)strtoul(argv[2], NULL, 10) : 600;
+
+  struct CPU cpu = {0};
+
+  struct File rom = {NULL, 0};
+  if (cartridge_map_file(argv[1], &rom) != CART_OK) {
+    printf("Error with reading *.gb\n");
+    return READ_FILE;
+  }
+
+  bus_init(&cpu.bus);
+  if (cartridge_init(&cpu, rom.data, rom.size, NULL) != CART_OK) {
+    printf("Unsupported cartridge\n");
+    cartridge_unmap_file(&rom);
+    return READ_FILE;
+  }
+  cpu_reset(&cpu);
+
+  counting = true;
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    run_frame(&cpu);
+  }
+  counting = false;
+
+  cartridge_free(&cpu.cart);
+  cartridge_unmap_file(&rom);
+
+  printf("%u frames: %llu allocations, %llu frees after init\n", frames,
+         (unsigned long long)allocations, (unsigned long long)frees);
+  return allocations == 0 && frees == 0 ? OK : ALLOCATED;
+}
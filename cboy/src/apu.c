@@ -0,0 +1,542 @@
+#include <apu.h>
+#include <blip.h>
+#include <emulation.h>
+#include <scheduler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Register offsets from 0xFF00, as they index apu->regs minus 0x10. */
+enum ApuRegister {
+  NR10 = 0x10,
+  NR11 = 0x11,
+  NR12 = 0x12,
+  NR13 = 0x13,
+  NR14 = 0x14,
+  NR21 = 0x16,
+  NR22 = 0x17,
+  NR23 = 0x18,
+  NR24 = 0x19,
+  NR30 = 0x1A,
+  NR31 = 0x1B,
+  NR32 = 0x1C,
+  NR33 = 0x1D,
+  NR34 = 0x1E,
+  NR41 = 0x20,
+  NR42 = 0x21,
+  NR43 = 0x22,
+  NR44 = 0x23,
+  NR50 = 0x24,
+  NR51 = 0x25,
+  NR52 = 0x26,
+  WAVE_RAM = 0x30,
+};
+
+#define REG(apu, reg) ((apu)->regs[(reg) - 0x10])
+
+#define TRIGGER 0x80
+#define LENGTH_ENABLE 0x40
+
+/* A blip frame is closed at least this often, so deltas stay inside the
+ * buffer however long the APU goes without being drained. */
+#define MAX_BLIP_FRAME CYCLES_PER_FRAME
+
+/* Each level step of each channel, on each side, at master volume 8. */
+#define OUTPUT_SCALE 32
+
+/* Bits read back from unused and write-only register bits. */
+static const uint8_t read_masks[0x30] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF,
+    0x9F, 0xFF, 0xBF, 0xFF, 0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static const uint8_t duty_waves[4] = {0x01, 0x81, 0x87, 0x7E};
+static const uint8_t noise_divisors[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+static inline uint32_t pulse_period(const struct Pulse *pulse) {
+  return (2048 - pulse->frequency) * 4;
+}
+
+static inline uint32_t wave_period(const struct Wave *wave) {
+  return (2048 - wave->frequency) * 2;
+}
+
+static inline uint32_t noise_period(const struct Apu *apu) {
+  const uint8_t nr43 = REG(apu, NR43);
+  return noise_divisors[nr43 & 7] << (nr43 >> 4);
+}
+
+static uint8_t pulse_level(const struct Pulse *pulse) {
+  if (!pulse->enabled || !pulse->dac) {
+    return 0;
+  }
+  return (duty_waves[pulse->duty] >> pulse->step) & 1 ? pulse->envelope.volume
+                                                      : 0;
+}
+
+static uint8_t wave_level(const struct Apu *apu) {
+  static const uint8_t shifts[4] = {4, 0, 1, 2};
+
+  if (!apu->wave.enabled || !apu->wave.dac) {
+    return 0;
+  }
+  return apu->wave.sample >> shifts[(REG(apu, NR32) >> 5) & 3];
+}
+
+static uint8_t noise_level(const struct Noise *noise) {
+  if (!noise->enabled || !noise->dac) {
+    return 0;
+  }
+  return noise->lfsr & 1 ? 0 : noise->envelope.volume;
+}
+
+/* Hands a change of a channel's mixed output to the blip buffers. */
+static void update_output(struct Apu *apu, uint8_t channel, uint64_t time) {
+  uint8_t level = 0;
+  switch (channel) {
+  case 0:
+  case 1:
+    level = pulse_level(&apu->pulse[channel]);
+    break;
+  case 2:
+    level = wave_level(apu);
+    break;
+  default:
+    level = noise_level(&apu->noise);
+    break;
+  }
+
+  const uint8_t panning = REG(apu, NR51);
+  const uint8_t volume = REG(apu, NR50);
+  const int16_t right =
+      panning & (1 << channel) ? level * ((volume & 7) + 1) * OUTPUT_SCALE : 0;
+  const int16_t left = panning & (0x10 << channel)
+                           ? level * (((volume >> 4) & 7) + 1) * OUTPUT_SCALE
+                           : 0;
+  const uint32_t offset = time - apu->frame_start;
+
+  if (left != apu->output[channel][0]) {
+    blip_add_delta(&apu->blip[0], offset, left - apu->output[channel][0]);
+    apu->output[channel][0] = left;
+  }
+  if (right != apu->output[channel][1]) {
+    blip_add_delta(&apu->blip[1], offset, right - apu->output[channel][1]);
+    apu->output[channel][1] = right;
+  }
+}
+
+static void update_all(struct Apu *apu, uint64_t time) {
+  for (uint8_t channel = 0; channel < 4; channel++) {
+    update_output(apu, channel, time);
+  }
+}
+
+/* Skips whole periods up to end without output, for silent channels. */
+static inline uint32_t skip_steps(uint64_t *next, uint32_t period,
+                                  uint64_t end) {
+  if (*next > end) {
+    return 0;
+  }
+  const uint64_t steps = (end - *next) / period + 1;
+  *next += steps * period;
+  return (uint32_t)steps;
+}
+
+static void run_pulse(struct Apu *apu, uint8_t channel, uint64_t end) {
+  struct Pulse *pulse = &apu->pulse[channel];
+  const uint32_t period = pulse_period(pulse);
+
+  if (!pulse->enabled) {
+    return;
+  }
+  if (!pulse->dac || pulse->envelope.volume == 0) {
+    const uint32_t steps = skip_steps(&pulse->next_step, period, end);
+    pulse->step = (pulse->step + steps) & 7;
+    return;
+  }
+  while (pulse->next_step <= end) {
+    pulse->step = (pulse->step + 1) & 7;
+    update_output(apu, channel, pulse->next_step);
+    pulse->next_step += period;
+  }
+}
+
+static void run_wave(struct Apu *apu, uint64_t end) {
+  struct Wave *wave = &apu->wave;
+  const uint32_t period = wave_period(wave);
+
+  if (!wave->enabled) {
+    return;
+  }
+  while (wave->next_step <= end) {
+    wave->position = (wave->position + 1) & 31;
+    const uint8_t byte = REG(apu, WAVE_RAM + wave->position / 2);
+    wave->sample = wave->position & 1 ? byte & 0x0F : byte >> 4;
+    update_output(apu, 2, wave->next_step);
+    wave->next_step += period;
+  }
+}
+
+static void run_noise(struct Apu *apu, uint64_t end) {
+  struct Noise *noise = &apu->noise;
+  const uint32_t period = noise_period(apu);
+  const bool narrow = REG(apu, NR43) & 0x08;
+
+  if (!noise->enabled) {
+    return;
+  }
+  /* Shifts 14 and 15 stop the LFSR. */
+  if ((REG(apu, NR43) >> 4) >= 14) {
+    skip_steps(&noise->next_step, period, end);
+    return;
+  }
+  while (noise->next_step <= end) {
+    const uint16_t bit = (noise->lfsr ^ (noise->lfsr >> 1)) & 1;
+    noise->lfsr = (noise->lfsr >> 1) | bit << 14;
+    if (narrow) {
+      noise->lfsr = (noise->lfsr & ~0x40) | bit << 6;
+    }
+    if (noise->dac && noise->envelope.volume != 0) {
+      update_output(apu, 3, noise->next_step);
+    }
+    noise->next_step += period;
+  }
+}
+
+static void clock_length(bool *enabled, uint16_t *length, bool length_enable) {
+  if (length_enable && *length > 0 && --*length == 0) {
+    *enabled = false;
+  }
+}
+
+static void clock_envelope(struct Envelope *envelope) {
+  if (envelope->period == 0 || --envelope->timer != 0) {
+    return;
+  }
+  envelope->timer = envelope->period;
+  if (envelope->increase && envelope->volume < 15) {
+    envelope->volume++;
+  } else if (!envelope->increase && envelope->volume > 0) {
+    envelope->volume--;
+  }
+}
+
+static uint16_t sweep_target(struct Apu *apu) {
+  struct Pulse *pulse = &apu->pulse[0];
+  const uint8_t nr10 = REG(apu, NR10);
+  const uint16_t delta = pulse->shadow >> (nr10 & 7);
+  const uint16_t target =
+      nr10 & 0x08 ? pulse->shadow - delta : pulse->shadow + delta;
+
+  if (target > 2047) {
+    pulse->enabled = false;
+  }
+  return target;
+}
+
+static void clock_sweep(struct Apu *apu) {
+  struct Pulse *pulse = &apu->pulse[0];
+  const uint8_t nr10 = REG(apu, NR10);
+  const uint8_t period = (nr10 >> 4) & 7;
+
+  if (pulse->sweep_timer == 0 || --pulse->sweep_timer != 0) {
+    return;
+  }
+  pulse->sweep_timer = period != 0 ? period : 8;
+  if (!pulse->sweep_enabled || period == 0) {
+    return;
+  }
+
+  const uint16_t target = sweep_target(apu);
+  if (target <= 2047 && (nr10 & 7) != 0) {
+    pulse->frequency = pulse->shadow = target;
+    REG(apu, NR13) = target & 0xFF;
+    REG(apu, NR14) = (REG(apu, NR14) & ~7) | target >> 8;
+    sweep_target(apu);
+  }
+}
+
+static void step_sequencer(struct Apu *apu) {
+  const uint8_t step = apu->sequencer_step;
+
+  if ((step & 1) == 0) {
+    for (uint8_t i = 0; i < 2; i++) {
+      clock_length(&apu->pulse[i].enabled, &apu->pulse[i].length,
+                   apu->pulse[i].length_enable);
+    }
+    clock_length(&apu->wave.enabled, &apu->wave.length,
+                 apu->wave.length_enable);
+    clock_length(&apu->noise.enabled, &apu->noise.length,
+                 apu->noise.length_enable);
+  }
+  if (step == 2 || step == 6) {
+    clock_sweep(apu);
+  }
+  if (step == 7) {
+    clock_envelope(&apu->pulse[0].envelope);
+    clock_envelope(&apu->pulse[1].envelope);
+    clock_envelope(&apu->noise.envelope);
+  }
+  apu->sequencer_step = (step + 1) & 7;
+}
+
+static void end_blip_frame(struct Apu *apu) {
+  const uint32_t length = apu->time - apu->frame_start;
+  blip_end_frame(&apu->blip[0], length);
+  blip_end_frame(&apu->blip[1], length);
+  apu->frame_start = apu->time;
+
+  /* Nobody is draining, keep the newest half of the buffer. */
+  const uint32_t avail = blip_samples_avail(&apu->blip[0]);
+  if (avail > BLIP_CAPACITY / 2) {
+    blip_read_samples(&apu->blip[0], NULL, avail - BLIP_CAPACITY / 2, 1);
+    blip_read_samples(&apu->blip[1], NULL, avail - BLIP_CAPACITY / 2, 1);
+  }
+}
+
+/* Runs the channels up to end, closing blip frames as they fill. */
+static void run_until(struct Apu *apu, uint64_t end) {
+  while (apu->time < end) {
+    const uint64_t frame_end = apu->frame_start + MAX_BLIP_FRAME;
+    const uint64_t until = end < frame_end ? end : frame_end;
+
+    run_pulse(apu, 0, until);
+    run_pulse(apu, 1, until);
+    run_wave(apu, until);
+    run_noise(apu, until);
+    apu->time = until;
+
+    if (until == frame_end) {
+      end_blip_frame(apu);
+    }
+  }
+}
+
+void apu_sync(struct CPU *cpu) {
+  run_until(&cpu->apu, cpu->cycles);
+}
+
+void apu_event(struct CPU *cpu, uint64_t time) {
+  struct Apu *apu = &cpu->apu;
+
+  run_until(apu, time);
+  if (apu->power) {
+    step_sequencer(apu);
+    update_all(apu, apu->time);
+  }
+  schedule(cpu, SCHED_APU, time + FRAME_SEQUENCER_PERIOD);
+}
+
+static void load_envelope(struct Envelope *envelope, uint8_t nrx2) {
+  envelope->volume = nrx2 >> 4;
+  envelope->increase = nrx2 & 0x08;
+  envelope->period = nrx2 & 7;
+  envelope->timer = envelope->period;
+}
+
+static void trigger_pulse(struct Apu *apu, uint8_t channel) {
+  struct Pulse *pulse = &apu->pulse[channel];
+  const uint8_t nr10 = REG(apu, NR10);
+
+  pulse->enabled = pulse->dac;
+  if (pulse->length == 0) {
+    pulse->length = 64;
+  }
+  pulse->next_step = apu->time + pulse_period(pulse);
+  load_envelope(&pulse->envelope, REG(apu, channel == 0 ? NR12 : NR22));
+
+  if (channel == 0) {
+    const uint8_t period = (nr10 >> 4) & 7;
+    pulse->shadow = pulse->frequency;
+    pulse->sweep_timer = period != 0 ? period : 8;
+    pulse->sweep_enabled = period != 0 || (nr10 & 7) != 0;
+    if (nr10 & 7) {
+      sweep_target(apu);
+    }
+  }
+}
+
+static void write_pulse(struct Apu *apu, uint8_t channel, uint8_t reg,
+                        uint8_t val) {
+  struct Pulse *pulse = &apu->pulse[channel];
+
+  switch (reg) {
+  case 1:
+    pulse->duty = val >> 6;
+    pulse->length = 64 - (val & 0x3F);
+    break;
+  case 2:
+    pulse->dac = (val & 0xF8) != 0;
+    if (!pulse->dac) {
+      pulse->enabled = false;
+    }
+    break;
+  case 3:
+    pulse->frequency = (pulse->frequency & 0x700) | val;
+    break;
+  case 4:
+    pulse->frequency = (pulse->frequency & 0xFF) | (val & 7) << 8;
+    pulse->length_enable = val & LENGTH_ENABLE;
+    if (val & TRIGGER) {
+      trigger_pulse(apu, channel);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void write_wave(struct Apu *apu, uint8_t reg, uint8_t val) {
+  struct Wave *wave = &apu->wave;
+
+  switch (reg) {
+  case NR30:
+    wave->dac = val & 0x80;
+    if (!wave->dac) {
+      wave->enabled = false;
+    }
+    break;
+  case NR31:
+    wave->length = 256 - val;
+    break;
+  case NR33:
+    wave->frequency = (wave->frequency & 0x700) | val;
+    break;
+  case NR34:
+    wave->frequency = (wave->frequency & 0xFF) | (val & 7) << 8;
+    wave->length_enable = val & LENGTH_ENABLE;
+    if (val & TRIGGER) {
+      wave->enabled = wave->dac;
+      if (wave->length == 0) {
+        wave->length = 256;
+      }
+      wave->position = 0;
+      wave->next_step = apu->time + wave_period(wave);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void write_noise(struct Apu *apu, uint8_t reg, uint8_t val) {
+  struct Noise *noise = &apu->noise;
+
+  switch (reg) {
+  case NR41:
+    noise->length = 64 - (val & 0x3F);
+    break;
+  case NR42:
+    noise->dac = (val & 0xF8) != 0;
+    if (!noise->dac) {
+      noise->enabled = false;
+    }
+    break;
+  case NR44:
+    noise->length_enable = val & LENGTH_ENABLE;
+    if (val & TRIGGER) {
+      noise->enabled = noise->dac;
+      if (noise->length == 0) {
+        noise->length = 64;
+      }
+      noise->lfsr = 0x7FFF;
+      noise->next_step = apu->time + noise_period(apu);
+      load_envelope(&noise->envelope, REG(apu, NR42));
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void power_off(struct Apu *apu) {
+  memset(apu->regs, 0, NR52 - 0x10);
+  apu->pulse[0] = (struct Pulse){0};
+  apu->pulse[1] = (struct Pulse){0};
+  apu->wave = (struct Wave){0};
+  apu->noise = (struct Noise){0};
+  apu->power = false;
+}
+
+void apu_reset(struct CPU *cpu) {
+  struct Apu *apu = &cpu->apu;
+  /* Register values the boot ROM leaves behind. */
+  static const uint8_t boot[NR52 - 0x10 + 1] = {
+      0x80, 0xBF, 0xF3, 0xFF, 0xBF, 0x00, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF,
+      0x9F, 0xFF, 0xBF, 0x00, 0xFF, 0x00, 0x00, 0xBF, 0x77, 0xF3, 0xF1,
+  };
+
+  memset(apu, 0, sizeof(*apu));
+  memcpy(apu->regs, boot, sizeof(boot));
+  apu->power = true;
+  apu->pulse[0].dac = true;
+  apu->pulse[0].duty = 2;
+  schedule(cpu, SCHED_APU, cpu->cycles + FRAME_SEQUENCER_PERIOD);
+  blip_init(&apu->blip[0], CLOCK_SPEED, APU_SAMPLE_RATE);
+  blip_init(&apu->blip[1], CLOCK_SPEED, APU_SAMPLE_RATE);
+}
+
+uint8_t apu_read(struct CPU *cpu, uint8_t reg) {
+  struct Apu *apu = &cpu->apu;
+
+  apu_sync(cpu);
+  if (reg == NR52) {
+    return 0x70 | apu->power << 7 | apu->noise.enabled << 3 |
+           apu->wave.enabled << 2 | apu->pulse[1].enabled << 1 |
+           apu->pulse[0].enabled;
+  }
+  return REG(apu, reg) | read_masks[reg - 0x10];
+}
+
+void apu_write(struct CPU *cpu, uint8_t reg, uint8_t val) {
+  struct Apu *apu = &cpu->apu;
+
+  apu_sync(cpu);
+  if (reg >= WAVE_RAM) {
+    REG(apu, reg) = val;
+    return;
+  }
+  if (reg == NR52) {
+    if (!(val & 0x80)) {
+      power_off(apu);
+    } else if (!apu->power) {
+      apu->power = true;
+      apu->sequencer_step = 0;
+    }
+    update_all(apu, apu->time);
+    return;
+  }
+  if (!apu->power) {
+    return;
+  }
+
+  REG(apu, reg) = val;
+  if (reg >= NR10 && reg <= NR14) {
+    write_pulse(apu, 0, reg - NR10, val);
+  } else if (reg >= NR21 - 1 && reg <= NR24) {
+    write_pulse(apu, 1, reg - (NR21 - 1), val);
+  } else if (reg >= NR30 && reg <= NR34) {
+    write_wave(apu, reg, val);
+  } else if (reg >= NR41 && reg <= NR44) {
+    write_noise(apu, reg, val);
+  }
+  update_all(apu, apu->time);
+}
+
+void apu_end_frame(struct CPU *cpu) {
+  apu_sync(cpu);
+  end_blip_frame(&cpu->apu);
+}
+
+uint32_t apu_samples_avail(struct CPU *cpu) {
+  return blip_samples_avail(&cpu->apu.blip[0]);
+}
+
+uint32_t apu_read_samples(struct CPU *cpu, int16_t *out, uint32_t count) {
+  struct Apu *apu = &cpu->apu;
+
+  const uint32_t read = blip_read_samples(&apu->blip[0], out, count, 2);
+  blip_read_samples(&apu->blip[1], out + 1, read, 2);
+  return read;
+}
@@ -0,0 +1,364 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
+#include <batch.h>
+#include <emulation.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+
+enum Task {
+  TASK_EMPTY = -1, /* nothing left to take */
+  TASK_ABORT = -2, /* lost a race for the last one, try again */
+};
+
+/* Chase-Lev deque over a fixed array. It is filled while the workers are
+ * parked, so during a run the owner only pops from the bottom and thieves
+ * only take from the top. */
+struct Deque {
+  _Alignas(CACHE_LINE) atomic_long top;
+  _Alignas(CACHE_LINE) atomic_long bottom;
+  uint32_t *tasks; /* instance indices */
+};
+
+struct Worker {
+  struct Deque deque;
+  struct Batch *batch;
+  pthread_t thread;
+  uint32_t index;
+  uint64_t frames;
+  uint64_t steals;
+};
+
+struct Batch {
+  struct CPU **instances;
+  uint32_t *affinity;
+  bool *loaded;
+  uint32_t count;
+
+  struct Worker *workers;
+  uint32_t worker_count;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t round; /* bumped to start the workers */
+  uint32_t busy;  /* workers still running this round */
+  uint32_t frames;
+  bool quit;
+
+  struct BatchStats stats;
+};
+
+static long deque_pop(struct Deque *deque) {
+  const long bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return TASK_EMPTY;
+  }
+  long task = deque->tasks[bottom];
+  if (top == bottom) {
+    /* The last one, a thief may be after it too. */
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      task = TASK_EMPTY;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+static long deque_steal(struct Deque *deque) {
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  const long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+  if (top >= bottom) {
+    return TASK_EMPTY;
+  }
+  const long task = deque->tasks[top];
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return TASK_ABORT;
+  }
+  return task;
+}
+
+/* Tries every other worker once, starting with the next one so thieves
+ * spread out instead of all hitting worker 0. */
+static long steal(struct Worker *worker) {
+  const struct Batch *batch = worker->batch;
+
+  for (uint32_t i = 1; i < batch->worker_count; i++) {
+    struct Worker *victim =
+        &batch->workers[(worker->index + i) % batch->worker_count];
+    long task;
+    do {
+      task = deque_steal(&victim->deque);
+    } while (task == TASK_ABORT);
+    if (task != TASK_EMPTY) {
+      worker->steals++;
+      return task;
+    }
+  }
+  return TASK_EMPTY;
+}
+
+static void run_round(struct Worker *worker, uint32_t frames) {
+  struct Batch *batch = worker->batch;
+
+  for (;;) {
+    long task = deque_pop(&worker->deque);
+    if (task == TASK_EMPTY) {
+      /* Nothing is queued during a round, so once every deque is empty
+       * the round is over for this worker. */
+      task = steal(worker);
+      if (task == TASK_EMPTY) {
+        return;
+      }
+    }
+    struct CPU *cpu = batch->instances[task];
+    for (uint32_t i = 0; i < frames; i++) {
+      run_frame(cpu);
+    }
+    worker->frames += frames;
+  }
+}
+
+static void pin(struct Worker *worker) {
+#ifdef __linux__
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+
+  if (cores < 1) {
+    return;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(worker->index % cores, &set);
+  /* Only a hint, a restricted cpuset may refuse it. */
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)worker;
+#endif
+}
+
+static void *worker_main(void *data) {
+  struct Worker *worker = data;
+  struct Batch *batch = worker->batch;
+  uint64_t seen = 0;
+
+  pin(worker);
+  pthread_mutex_lock(&batch->lock);
+  for (;;) {
+    while (!batch->quit && batch->round == seen) {
+      pthread_cond_wait(&batch->start, &batch->lock);
+    }
+    if (batch->quit) {
+      break;
+    }
+    seen = batch->round;
+    const uint32_t frames = batch->frames;
+    pthread_mutex_unlock(&batch->lock);
+
+    run_round(worker, frames);
+
+    pthread_mutex_lock(&batch->lock);
+    if (--batch->busy == 0) {
+      pthread_cond_signal(&batch->done);
+    }
+  }
+  pthread_mutex_unlock(&batch->lock);
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+struct Batch *batch_create(uint32_t instances, uint32_t workers) {
+  if (workers == 0) {
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cores > 0 ? (uint32_t)cores : 1;
+  }
+
+  struct Batch *batch = calloc(1, sizeof(*batch));
+  if (batch == NULL) {
+    return NULL;
+  }
+  batch->count = instances;
+  batch->instances = calloc(instances, sizeof(*batch->instances));
+  batch->affinity = calloc(instances, sizeof(*batch->affinity));
+  batch->loaded = calloc(instances, sizeof(*batch->loaded));
+  /* Workers are cache line aligned so one worker's deque indices never
+   * share a line with its neighbour's. */
+  batch->workers =
+      aligned_alloc(_Alignof(struct Worker), workers * sizeof(struct Worker));
+  if (batch->instances == NULL || batch->affinity == NULL ||
+      batch->loaded == NULL || batch->workers == NULL) {
+    batch_destroy(batch);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < instances; i++) {
+    batch->instances[i] = calloc(1, sizeof(struct CPU));
+    if (batch->instances[i] == NULL) {
+      batch_destroy(batch);
+      return NULL;
+    }
+    bus_init(&batch->instances[i]->bus);
+    batch->affinity[i] = i;
+  }
+
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->start, NULL);
+  pthread_cond_init(&batch->done, NULL);
+  for (uint32_t i = 0; i < workers; i++) {
+    struct Worker *worker = &batch->workers[i];
+    memset(worker, 0, sizeof(*worker));
+    worker->batch = batch;
+    worker->index = i;
+    worker->deque.tasks = calloc(instances > 0 ? instances : 1,
+                                 sizeof(*worker->deque.tasks));
+    if (worker->deque.tasks == NULL ||
+        pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+      free(worker->deque.tasks);
+      break;
+    }
+    batch->worker_count++;
+  }
+  if (batch->worker_count == 0) {
+    batch_destroy(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+void batch_destroy(struct Batch *batch) {
+  if (batch == NULL) {
+    return;
+  }
+
+  if (batch->worker_count > 0) {
+    pthread_mutex_lock(&batch->lock);
+    batch->quit = true;
+    pthread_cond_broadcast(&batch->start);
+    pthread_mutex_unlock(&batch->lock);
+    for (uint32_t i = 0; i < batch->worker_count; i++) {
+      pthread_join(batch->workers[i].thread, NULL);
+      free(batch->workers[i].deque.tasks);
+    }
+    pthread_cond_destroy(&batch->done);
+    pthread_cond_destroy(&batch->start);
+    pthread_mutex_destroy(&batch->lock);
+  }
+
+  for (uint32_t i = 0; batch->instances != NULL && i < batch->count; i++) {
+    if (batch->loaded != NULL && batch->loaded[i]) {
+      cartridge_free(&batch->instances[i]->cart);
+    }
+    free(batch->instances[i]);
+  }
+  free(batch->workers);
+  free(batch->loaded);
+  free(batch->affinity);
+  free(batch->instances);
+  free(batch);
+}
+
+uint32_t batch_instances(const struct Batch *batch) { return batch->count; }
+
+uint32_t batch_workers(const struct Batch *batch) {
+  return batch->worker_count;
+}
+
+struct CPU *batch_instance(struct Batch *batch, uint32_t instance) {
+  return batch->instances[instance];
+}
+
+enum CartridgeError batch_load(struct Batch *batch, uint32_t instance,
+                               uint8_t *rom, uint32_t size) {
+  struct CPU *cpu = batch->instances[instance];
+
+  if (batch->loaded[instance]) {
+    cartridge_free(&cpu->cart);
+    batch->loaded[instance] = false;
+  }
+  memset(cpu, 0, sizeof(*cpu));
+  bus_init(&cpu->bus);
+
+  const enum CartridgeError err = cartridge_init(cpu, rom, size, NULL);
+  if (err != CART_OK) {
+    return err;
+  }
+  cpu_reset(cpu);
+  batch->loaded[instance] = true;
+  return CART_OK;
+}
+
+void batch_set_affinity(struct Batch *batch, uint32_t instance,
+                        uint32_t worker) {
+  batch->affinity[instance] = worker;
+}
+
+void batch_run(struct Batch *batch, uint32_t frames) {
+  const double start = now();
+
+  /* The workers are parked, plain stores are published by the lock. */
+  for (uint32_t i = 0; i < batch->worker_count; i++) {
+    atomic_store_explicit(&batch->workers[i].deque.top, 0,
+                          memory_order_relaxed);
+    atomic_store_explicit(&batch->workers[i].deque.bottom, 0,
+                          memory_order_relaxed);
+  }
+  for (uint32_t i = 0; i < batch->count; i++) {
+    if (!batch->loaded[i]) {
+      continue;
+    }
+    struct Deque *deque =
+        &batch->workers[batch->affinity[i] % batch->worker_count].deque;
+    const long bottom =
+        atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    deque->tasks[bottom] = i;
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+
+  pthread_mutex_lock(&batch->lock);
+  for (uint32_t i = 0; i < batch->worker_count; i++) {
+    batch->workers[i].frames = 0;
+    batch->workers[i].steals = 0;
+  }
+  batch->frames = frames;
+  batch->busy = batch->worker_count;
+  batch->round++;
+  pthread_cond_broadcast(&batch->start);
+  while (batch->busy > 0) {
+    pthread_cond_wait(&batch->done, &batch->lock);
+  }
+  for (uint32_t i = 0; i < batch->worker_count; i++) {
+    batch->stats.frames += batch->workers[i].frames;
+    batch->stats.steals += batch->workers[i].steals;
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  batch->stats.seconds += now() - start;
+}
+
+struct BatchStats batch_stats(const struct Batch *batch) {
+  return batch->stats;
+}
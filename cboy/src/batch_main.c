@@ -0,0 +1,103 @@
+#include <batch.h>
+#include <emulation.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Runs many instances of one or more ROMs on the batch pool and reports
+ * the aggregate speed. ROMs are handed out to instances in turn. */
+
+#define MAX_ROMS 64
+
+static const char usage[] =
+    "usage: cboy-batch [--instances N] [--workers N] [--frames N]\n"
+    "                  [--step N] [--render-every N] <rom.gb>...\n"
+    "  --instances N     emulators to run, 64 by default\n"
+    "  --workers N       threads, one per core by default\n"
+    "  --frames N        frames per instance, 600 by default\n"
+    "  --step N          frames per batch_run call, 60 by default\n"
+    "  --render-every N  draw every Nth frame, 0 (never) by default\n";
+
+int main(const int argc, char *argv[]) {
+  enum Errors { OK, WRONG_ARG, READ_FILE, NO_MEMORY };
+  struct File roms[MAX_ROMS];
+  uint32_t rom_count = 0;
+  uint32_t instances = 64;
+  uint32_t workers = 0;
+  uint32_t frames = 600;
+  uint32_t step = 60;
+  uint8_t render_every = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (strcmp(argv[i], "--instances") == 0) {
+      instances = (uint32_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (strcmp(argv[i], "--workers") == 0) {
+      workers = (uint32_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      frames = (uint32_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (strcmp(argv[i], "--step") == 0) {
+      step = (uint32_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (strcmp(argv[i], "--render-every") == 0) {
+      render_every = (uint8_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (argv[i][0] == '-' || rom_count == MAX_ROMS) {
+      fputs(usage, stderr);
+      return WRONG_ARG;
+    } else {
+      const uint32_t err = cartridge_map_file(argv[i], &roms[rom_count]);
+      if (err != CART_OK) {
+        fprintf(stderr, "Error with reading %s: %u\n", argv[i], err);
+        return READ_FILE;
+      }
+      rom_count++;
+    }
+  }
+  if (rom_count == 0 || instances == 0 || step == 0) {
+    fputs(usage, stderr);
+    return WRONG_ARG;
+  }
+
+  struct Batch *batch = batch_create(instances, workers);
+  if (batch == NULL) {
+    fprintf(stderr, "Cannot create %u instances\n", instances);
+    return NO_MEMORY;
+  }
+
+  enum Errors result = OK;
+  for (uint32_t i = 0; i < instances && result == OK; i++) {
+    /* Every instance of a ROM shares its read only mapping. */
+    struct File *rom = &roms[i % rom_count];
+    const uint32_t err = batch_load(batch, i, rom->data, rom->size);
+    if (err != CART_OK) {
+      fprintf(stderr, "Unsupported cartridge: %u\n", err);
+      result = READ_FILE;
+    }
+    ppu_set_render_interval(batch_instance(batch, i), render_every);
+  }
+
+  for (uint32_t done = 0; done < frames && result == OK; done += step) {
+    batch_run(batch, frames - done < step ? frames - done : step);
+  }
+
+  if (result == OK) {
+    const struct BatchStats stats = batch_stats(batch);
+    printf("%u instances, %u workers: %llu frames in %.3f s, %.0f fps "
+           "(%.1fx real time), %llu steals\n",
+           instances, batch_workers(batch), (unsigned long long)stats.frames,
+           stats.seconds, stats.frames / stats.seconds,
+           stats.frames / stats.seconds * CYCLES_PER_FRAME / CLOCK_SPEED,
+           (unsigned long long)stats.steals);
+  }
+
+  batch_destroy(batch);
+  for (uint32_t i = 0; i < rom_count; i++) {
+    cartridge_unmap_file(&roms[i]);
+  }
+  return result;
+}
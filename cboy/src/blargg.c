@@ -0,0 +1,265 @@
+#include <dirent.h>
+#include <emulation.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Runs blargg's test ROMs, one per worker thread, and prints the results
+ * as JSON. A ROM is done when its serial output says "Passed" or "Failed",
+ * when it spins with interrupts off, or after the frame limit.
+ * Usage: cboy-blargg [--jobs N] [--frames N] <rom.gb | dir>... */
+
+#define MAX_ROMS 256
+#define SERIAL_SIZE 4096
+#define DEFAULT_FRAMES 10000 /* cpu_instrs.gb needs about 3300 */
+#define GRACE_FRAMES 30      /* serial text after the verdict */
+
+/* Zero is an error, so a job no worker got to does not pass. */
+enum Result {
+  RESULT_ERROR,
+  RESULT_PASSED,
+  RESULT_FAILED,
+  RESULT_HANG,
+  RESULT_TIMEOUT,
+};
+
+static const char *const result_names[] = {"error", "passed", "failed",
+                                           "hang", "timeout"};
+
+struct Job {
+  char path[1024];
+  enum Result result;
+  uint32_t frames;
+  double seconds;
+  char serial[SERIAL_SIZE];
+  uint32_t serial_size;
+};
+
+struct Runner {
+  struct Job *jobs;
+  uint32_t count;
+  uint32_t frame_limit;
+  atomic_uint next; /* first job nobody has picked up yet */
+};
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void capture_serial(void *user, uint8_t byte) {
+  struct Job *job = user;
+  if (job->serial_size < SERIAL_SIZE - 1) {
+    job->serial[job->serial_size++] = byte;
+    job->serial[job->serial_size] = '\0';
+  }
+}
+
+/* The tests end in a loop, a hang is one nothing can break out of. */
+static bool spinning(struct CPU *cpu) {
+  const uint16_t pc = cpu->registers.PC;
+  const uint8_t op = bus_read(cpu, pc);
+
+  if (cpu->ime) {
+    return false;
+  }
+  if (op == 0x18 && bus_read(cpu, pc + 1) == 0xFE) {
+    return true; /* JR -2 */
+  }
+  if (op == 0xC3 &&
+      (bus_read(cpu, pc + 1) | bus_read(cpu, pc + 2) << 8) == pc) {
+    return true; /* JP to itself */
+  }
+  return cpu->halted && cpu->bus.ie == 0;
+}
+
+static void run_job(struct CPU *cpu, struct Job *job, uint32_t frame_limit) {
+  const double start = now();
+  struct File rom = {NULL, 0};
+
+  job->result = RESULT_ERROR;
+  if (cartridge_map_file(job->path, &rom) != CART_OK) {
+    return;
+  }
+
+  memset(cpu, 0, sizeof(*cpu));
+  bus_init(&cpu->bus);
+  if (cartridge_init(cpu, rom.data, rom.size, NULL) != CART_OK) {
+    cartridge_unmap_file(&rom);
+    return;
+  }
+  cpu_reset(cpu);
+  ppu_set_render_interval(cpu, 0);
+  cpu->serial.out = capture_serial;
+  cpu->serial.user = job;
+
+  uint32_t stop = frame_limit;
+  bool hung = false;
+  for (job->frames = 0; job->frames < stop; job->frames++) {
+    run_frame(cpu);
+    if (stop == frame_limit && (strstr(job->serial, "Passed") != NULL ||
+                                strstr(job->serial, "Failed") != NULL)) {
+      stop = job->frames + GRACE_FRAMES;
+    }
+    if (spinning(cpu)) {
+      hung = true;
+      job->frames++;
+      break;
+    }
+  }
+
+  if (strstr(job->serial, "Passed") != NULL) {
+    job->result = RESULT_PASSED;
+  } else if (strstr(job->serial, "Failed") != NULL) {
+    job->result = RESULT_FAILED;
+  } else {
+    job->result = hung ? RESULT_HANG : RESULT_TIMEOUT;
+  }
+
+  cartridge_free(&cpu->cart);
+  cartridge_unmap_file(&rom);
+  job->seconds = now() - start;
+}
+
+static void *worker(void *data) {
+  struct Runner *runner = data;
+  struct CPU *cpu = malloc(sizeof(*cpu));
+
+  if (cpu == NULL) {
+    return NULL;
+  }
+  for (;;) {
+    const uint32_t i = atomic_fetch_add(&runner->next, 1);
+    if (i >= runner->count) {
+      break;
+    }
+    run_job(cpu, &runner->jobs[i], runner->frame_limit);
+  }
+  free(cpu);
+  return NULL;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+  return strcmp(((const struct Job *)a)->path, ((const struct Job *)b)->path);
+}
+
+/* A directory adds every .gb file in it, anything else is taken as a ROM.
+ * Returns false when there are more than MAX_ROMS. */
+static bool add_path(struct Runner *runner, const char *path) {
+  DIR *dir = opendir(path);
+
+  if (dir == NULL) {
+    if (runner->count == MAX_ROMS) {
+      return false;
+    }
+    snprintf(runner->jobs[runner->count++].path, sizeof(runner->jobs->path),
+             "%s", path);
+    return true;
+  }
+
+  const uint32_t first = runner->count;
+  const struct dirent *entry;
+  bool ok = true;
+  while ((entry = readdir(dir)) != NULL) {
+    const size_t length = strlen(entry->d_name);
+    if (length <= 3 || strcmp(entry->d_name + length - 3, ".gb") != 0) {
+      continue;
+    }
+    if (runner->count == MAX_ROMS) {
+      ok = false;
+      break;
+    }
+    snprintf(runner->jobs[runner->count++].path, sizeof(runner->jobs->path),
+             "%s/%s", path, entry->d_name);
+  }
+  closedir(dir);
+  qsort(runner->jobs + first, runner->count - first, sizeof(*runner->jobs),
+        compare_jobs);
+  return ok;
+}
+
+static void print_string(const char *s) {
+  putchar('"');
+  for (; *s != '\0'; s++) {
+    const unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c == '\n') {
+      fputs("\\n", stdout);
+    } else if (c < 0x20 || c >= 0x7F) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+int main(const int argc, char *argv[]) {
+  enum Errors { OK, WRONG_ARG, FAILED };
+  static struct Job jobs[MAX_ROMS];
+  struct Runner runner = {jobs, 0, DEFAULT_FRAMES, 0};
+  long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      thread_count = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      runner.frame_limit = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if (!add_path(&runner, argv[i])) {
+      fprintf(stderr, "cboy-blargg: more than %d ROMs\n", MAX_ROMS);
+      return WRONG_ARG;
+    }
+  }
+  if (runner.count == 0) {
+    printf("usage: cboy-blargg [--jobs N] [--frames N] <rom.gb | dir>...\n");
+    return WRONG_ARG;
+  }
+  if (thread_count < 1) {
+    thread_count = 1;
+  }
+  if (thread_count > (long)runner.count) {
+    thread_count = runner.count;
+  }
+
+  const double start = now();
+  pthread_t threads[MAX_ROMS];
+  long started = 0;
+  while (started < thread_count &&
+         pthread_create(&threads[started], NULL, worker, &runner) == 0) {
+    started++;
+  }
+  if (started == 0) {
+    worker(&runner);
+  }
+  for (long i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  const double seconds = now() - start;
+
+  uint32_t passed = 0;
+  printf("{\n  \"results\": [\n");
+  for (uint32_t i = 0; i < runner.count; i++) {
+    const struct Job *job = &jobs[i];
+    passed += job->result == RESULT_PASSED;
+    printf("    {\"rom\": ");
+    print_string(job->path);
+    printf(", \"result\": \"%s\", \"frames\": %u, \"seconds\": %.3f, "
+           "\"serial\": ",
+           result_names[job->result], job->frames, job->seconds);
+    print_string(job->serial);
+    printf("}%s\n", i + 1 < runner.count ? "," : "");
+  }
+  printf("  ],\n  \"passed\": %u,\n  \"total\": %u,\n  \"threads\": %ld,\n"
+         "  \"seconds\": %.3f\n}\n",
+         passed, runner.count, started > 0 ? started : 1, seconds);
+
+  return passed == runner.count ? OK : FAILED;
+}
@@ -0,0 +1,148 @@
+#include <blip.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRACTION_BITS 32
+#define PHASE_SHIFT (FRACTION_BITS - 5) /* log2(BLIP_PHASES) */
+#define DELTA_BITS 15
+#define BASS_SHIFT 9 /* integrator leak, a high-pass around 16 Hz */
+
+/* Blackman windowed sinc at 0.92 of Nyquist, one row per sub-sample
+ * phase, every row summing to 1 << DELTA_BITS. */
+static const int16_t kernel[BLIP_PHASES][BLIP_WIDTH] = {
+    {21, -115, 341, -749, 1320, -1944, 2434, 30152,
+     2434, -1944, 1320, -749, 341, -115, 21, 0},
+    {20, -110, 320, -685, 1161, -1579, 1516, 30105,
+     3399, -2309, 1476, -809, 361, -120, 22, 0},
+    {19, -103, 297, -618, 999, -1218, 645, 29977,
+     4405, -2672, 1625, -865, 378, -124, 23, 0},
+    {17, -96, 272, -549, 836, -863, -174, 29764,
+     5450, -3029, 1767, -916, 393, -128, 24, 0},
+    {16, -89, 247, -480, 673, -517, -939, 29467,
+     6530, -3377, 1900, -962, 405, -130, 24, 0},
+    {14, -81, 221, -409, 511, -183, -1649, 29089,
+     7639, -3713, 2022, -1001, 414, -130, 24, 0},
+    {13, -74, 194, -339, 353, 138, -2301, 28630,
+     8774, -4033, 2132, -1033, 420, -130, 24, 0},
+    {11, -66, 168, -269, 199, 442, -2895, 28094,
+     9929, -4333, 2228, -1057, 422, -128, 23, 0},
+    {10, -58, 141, -200, 50, 730, -3430, 27483,
+     11100, -4610, 2308, -1073, 420, -125, 22, 0},
+    {9, -50, 115, -134, -92, 998, -3905, 26801,
+     12281, -4862, 2372, -1080, 414, -120, 21, 0},
+    {7, -43, 90, -69, -227, 1246, -4321, 26052,
+     13467, -5083, 2418, -1077, 403, -114, 19, 0},
+    {6, -35, 65, -8, -354, 1472, -4677, 25239,
+     14653, -5271, 2444, -1065, 389, -106, 16, 0},
+    {5, -28, 42, 51, -471, 1675, -4975, 24365,
+     15832, -5422, 2450, -1042, 369, -96, 13, 0},
+    {4, -21, 19, 105, -580, 1855, -5214, 23437,
+     16999, -5534, 2435, -1008, 345, -84, 10, 0},
+    {3, -15, -2, 156, -678, 2011, -5397, 22459,
+     18149, -5603, 2397, -964, 317, -71, 6, 0},
+    {2, -9, -21, 203, -766, 2144, -5526, 21436,
+     19275, -5626, 2336, -909, 283, -56, 1, 1},
+    {2, -4, -40, 245, -843, 2252, -5602, 20373,
+     20375, -5602, 2252, -843, 245, -40, -4, 2},
+    {1, 1, -56, 283, -909, 2336, -5626, 19275,
+     21436, -5526, 2144, -766, 203, -21, -9, 2},
+    {0, 6, -71, 317, -964, 2397, -5603, 18149,
+     22459, -5397, 2011, -678, 156, -2, -15, 3},
+    {0, 10, -84, 345, -1008, 2435, -5534, 16999,
+     23437, -5214, 1855, -580, 105, 19, -21, 4},
+    {0, 13, -96, 369, -1042, 2450, -5422, 15832,
+     24365, -4975, 1675, -471, 51, 42, -28, 5},
+    {0, 16, -106, 389, -1065, 2444, -5271, 14653,
+     25239, -4677, 1472, -354, -8, 65, -35, 6},
+    {0, 19, -114, 403, -1077, 2418, -5083, 13467,
+     26052, -4321, 1246, -227, -69, 90, -43, 7},
+    {0, 21, -120, 414, -1080, 2372, -4862, 12281,
+     26801, -3905, 998, -92, -134, 115, -50, 9},
+    {0, 22, -125, 420, -1073, 2308, -4610, 11100,
+     27483, -3430, 730, 50, -200, 141, -58, 10},
+    {0, 23, -128, 422, -1057, 2228, -4333, 9929,
+     28094, -2895, 442, 199, -269, 168, -66, 11},
+    {0, 24, -130, 420, -1033, 2132, -4033, 8774,
+     28630, -2301, 138, 353, -339, 194, -74, 13},
+    {0, 24, -130, 414, -1001, 2022, -3713, 7639,
+     29089, -1649, -183, 511, -409, 221, -81, 14},
+    {0, 24, -130, 405, -962, 1900, -3377, 6530,
+     29467, -939, -517, 673, -480, 247, -89, 16},
+    {0, 24, -128, 393, -916, 1767, -3029, 5450,
+     29764, -174, -863, 836, -549, 272, -96, 17},
+    {0, 23, -124, 378, -865, 1625, -2672, 4405,
+     29977, 645, -1218, 999, -618, 297, -103, 19},
+    {0, 22, -120, 361, -809, 1476, -2309, 3399,
+     30105, 1516, -1579, 1161, -685, 320, -110, 20},
+};
+
+void blip_init(struct Blip *blip, uint32_t clock_rate, uint32_t sample_rate) {
+  blip->factor = ((uint64_t)sample_rate << FRACTION_BITS) / clock_rate;
+  blip_clear(blip);
+}
+
+void blip_clear(struct Blip *blip) {
+  blip->offset = 0;
+  blip->integrator = 0;
+  memset(blip->buffer, 0, sizeof(blip->buffer));
+}
+
+void blip_add_delta(struct Blip *blip, uint32_t time, int32_t delta) {
+  const uint64_t fixed = time * blip->factor + blip->offset;
+  const uint64_t sample = fixed >> FRACTION_BITS;
+
+  /* A frame longer than the buffer loses its tail rather than overrun. */
+  if (sample >= BLIP_CAPACITY) {
+    return;
+  }
+
+  const int16_t *row = kernel[(fixed >> PHASE_SHIFT) & (BLIP_PHASES - 1)];
+  int32_t *out = blip->buffer + sample;
+  for (uint8_t i = 0; i < BLIP_WIDTH; i++) {
+    out[i] += row[i] * delta;
+  }
+}
+
+void blip_end_frame(struct Blip *blip, uint32_t time) {
+  blip->offset += time * blip->factor;
+  if (blip_samples_avail(blip) > BLIP_CAPACITY) {
+    blip->offset = (uint64_t)BLIP_CAPACITY << FRACTION_BITS |
+                   (blip->offset & ((1ULL << FRACTION_BITS) - 1));
+  }
+}
+
+uint32_t blip_samples_avail(const struct Blip *blip) {
+  return blip->offset >> FRACTION_BITS;
+}
+
+uint32_t blip_read_samples(struct Blip *blip, int16_t *out, uint32_t count,
+                           uint32_t stride) {
+  const uint32_t avail = blip_samples_avail(blip);
+  if (count > avail) {
+    count = avail;
+  }
+
+  int32_t sum = blip->integrator;
+  for (uint32_t i = 0; i < count; i++) {
+    int32_t s = sum >> DELTA_BITS;
+    sum += blip->buffer[i];
+    sum -= s * (1 << (DELTA_BITS - BASS_SHIFT));
+    if (s > INT16_MAX) {
+      s = INT16_MAX;
+    } else if (s < INT16_MIN) {
+      s = INT16_MIN;
+    }
+    if (out != NULL) {
+      out[i * stride] = (int16_t)s;
+    }
+  }
+  blip->integrator = sum;
+
+  /* Shift the unread samples and the kernel tails down. */
+  const uint32_t remain = avail - count + BLIP_WIDTH;
+  memmove(blip->buffer, blip->buffer + count, remain * sizeof(int32_t));
+  memset(blip->buffer + remain, 0, count * sizeof(int32_t));
+  blip->offset -= (uint64_t)count << FRACTION_BITS;
+  return count;
+}
@@ -0,0 +1,131 @@
+#include <apu.h>
+#include <bus.h>
+#include <cartridge.h>
+#include <emulation.h>
+#include <joypad.h>
+#include <ppu.h>
+#include <serial.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <timer.h>
+
+/* Handlers for 0xFF00-0xFF7F. A NULL read or write handler falls back to
+ * plain storage in bus->io. */
+struct IoHandler {
+  uint8_t (*read)(struct CPU *cpu, uint8_t reg);
+  void (*write)(struct CPU *cpu, uint8_t reg, uint8_t val);
+};
+
+static uint8_t interrupt_flag_read(struct CPU *cpu, uint8_t reg) {
+  return cpu->bus.io[reg] | 0xE0;
+}
+
+static void interrupt_flag_write(struct CPU *cpu, uint8_t reg, uint8_t val) {
+  cpu->bus.io[reg] = val & 0x1F;
+}
+
+static const struct IoHandler io_handlers[0x80] = {
+    [0x00] = {joypad_read, NULL},
+    [0x01] = {serial_read, serial_write},
+    [0x02] = {serial_read, serial_write},
+    [0x04] = {timer_read, timer_write},
+    [0x05] = {timer_read, timer_write},
+    [0x06] = {timer_read, timer_write},
+    [0x07] = {timer_read, timer_write},
+    [0x0F] = {interrupt_flag_read, interrupt_flag_write},
+    [0x10 ... 0x3F] = {apu_read, apu_write},
+    [0x40] = {ppu_read, ppu_write},
+    [0x41] = {ppu_read, ppu_write},
+    [0x42] = {ppu_read, ppu_write},
+    [0x43] = {ppu_read, ppu_write},
+    [0x44] = {ppu_read, ppu_write},
+    [0x45] = {ppu_read, ppu_write},
+    [0x46] = {ppu_read, ppu_write},
+    [0x47] = {ppu_read, ppu_write},
+    [0x48] = {ppu_read, ppu_write},
+    [0x49] = {ppu_read, ppu_write},
+    [0x4A] = {ppu_read, ppu_write},
+    [0x4B] = {ppu_read, ppu_write},
+};
+
+void bus_map(struct MemoryBus *bus, uint8_t first_page, uint16_t count,
+             uint8_t *read_base, uint8_t *write_base) {
+  for (uint16_t i = 0; i < count; i++) {
+    bus->read_pages[first_page + i] =
+        read_base != NULL ? read_base + i * PAGE_SIZE : NULL;
+    bus->write_pages[first_page + i] =
+        write_base != NULL ? write_base + i * PAGE_SIZE : NULL;
+  }
+}
+
+void bus_init(struct MemoryBus *bus) {
+  memset(bus, 0, sizeof(*bus));
+  bus_map_fixed(bus);
+}
+
+void bus_map_fixed(struct MemoryBus *bus) {
+  /* Tile data writes go through the PPU to invalidate its tile cache. */
+  bus_map(bus, 0x80, 0x18, bus->vram, NULL);
+  bus_map(bus, 0x98, 0x08, bus->vram + 0x1800, bus->vram + 0x1800);
+  bus_map(bus, 0xA0, 0x20, NULL, NULL);
+  bus_map(bus, 0xC0, 0x20, bus->wram, bus->wram);
+  /* Echo RAM: 0xE000-0xFDFF alias 0xC000-0xDDFF. */
+  bus_map(bus, 0xE0, 0x1E, bus->wram, bus->wram);
+  bus_map(bus, 0xFE, 0x02, NULL, NULL);
+}
+
+uint8_t bus_read_slow(struct CPU *cpu, uint16_t address) {
+  struct MemoryBus *bus = &cpu->bus;
+
+  if (address >= 0xFF80) {
+    return address == IE_ADDRESS ? bus->ie : bus->hram[address - 0xFF80];
+  }
+  if (address >= 0xFF00) {
+    const uint8_t reg = address & 0x7F;
+    if (io_handlers[reg].read != NULL) {
+      return io_handlers[reg].read(cpu, reg);
+    }
+    return bus->io[reg];
+  }
+  if (address >= 0xFE00) {
+    return address < 0xFEA0 && !cpu->ppu.dma ? bus->oam[address - 0xFE00]
+                                             : 0xFF;
+  }
+
+  return cartridge_read(cpu, address);
+}
+
+void bus_write_slow(struct CPU *cpu, uint16_t address, uint8_t val) {
+  struct MemoryBus *bus = &cpu->bus;
+
+  if (address >= 0xFF80) {
+    if (address == IE_ADDRESS) {
+      bus->ie = val;
+    } else {
+      bus->hram[address - 0xFF80] = val;
+    }
+    return;
+  }
+  if (address >= 0xFF00) {
+    const uint8_t reg = address & 0x7F;
+    if (io_handlers[reg].write != NULL) {
+      io_handlers[reg].write(cpu, reg, val);
+    } else {
+      bus->io[reg] = val;
+    }
+    return;
+  }
+  if (address >= 0xFE00) {
+    if (address < 0xFEA0 && !cpu->ppu.dma) {
+      bus->oam[address - 0xFE00] = val;
+    }
+    return;
+  }
+  if (address >= 0x8000 && address < 0x9800) {
+    ppu_write_vram(cpu, address, val);
+    return;
+  }
+
+  cartridge_write(cpu, address, val);
+}
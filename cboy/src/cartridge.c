@@ -0,0 +1,518 @@
+#include <bus.h>
+#include <cartridge.h>
+#include <emulation.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER_TITLE 0x134
+#define HEADER_TYPE 0x147
+#define HEADER_ROM_SIZE 0x148
+#define HEADER_RAM_SIZE 0x149
+#define HEADER_CHECKSUM 0x14D
+#define HEADER_END 0x150
+
+/* 0x148 codes 0x00-0x08 are 32 KiB << code. */
+#define ROM_SIZE_CODES 9
+
+#define MBC3_RTC_SELECT 0x08
+
+/* Clock data other emulators append to MBC3 saves, 32 or 64-bit time. */
+#define RTC_FOOTER_SMALL 44
+#define RTC_FOOTER_LARGE 48
+
+static const uint32_t ram_sizes[6] = {0, 0x800, 0x2000, 0x8000, 0x20000,
+                                      0x10000};
+
+static enum CartridgeError parse_type(struct Cartridge *cart, uint8_t type) {
+  cart->battery = false;
+
+  switch (type) {
+  case 0x00:
+  case 0x08:
+    cart->mapper = MAPPER_NONE;
+    break;
+  case 0x09:
+    cart->mapper = MAPPER_NONE;
+    cart->battery = true;
+    break;
+  case 0x01:
+  case 0x02:
+    cart->mapper = MAPPER_MBC1;
+    break;
+  case 0x03:
+    cart->mapper = MAPPER_MBC1;
+    cart->battery = true;
+    break;
+  case 0x05:
+    cart->mapper = MAPPER_MBC2;
+    break;
+  case 0x06:
+    cart->mapper = MAPPER_MBC2;
+    cart->battery = true;
+    break;
+  case 0x11:
+  case 0x12:
+    cart->mapper = MAPPER_MBC3;
+    break;
+  case 0x0F:
+  case 0x10:
+  case 0x13:
+    cart->mapper = MAPPER_MBC3;
+    cart->battery = true;
+    break;
+  case 0x19:
+  case 0x1A:
+  case 0x1C:
+  case 0x1D:
+    cart->mapper = MAPPER_MBC5;
+    break;
+  case 0x1B:
+  case 0x1E:
+    cart->mapper = MAPPER_MBC5;
+    cart->battery = true;
+    break;
+  default:
+    return CART_UNSUPPORTED;
+  }
+
+  return CART_OK;
+}
+
+static uint8_t ram_bank(const struct Cartridge *cart) {
+  if (cart->mapper == MAPPER_MBC1) {
+    return cart->mbc1_mode == 1 ? cart->mbc1_bank2 : 0;
+  }
+  return cart->ram_bank;
+}
+
+static uint32_t ram_offset(const struct Cartridge *cart, uint16_t address) {
+  if (cart->ram_banks == 0) {
+    return (address - 0xA000) % cart->ram_size;
+  }
+  return (ram_bank(cart) % cart->ram_banks) * RAM_BANK_SIZE +
+         (address - 0xA000);
+}
+
+static void map_rom(struct CPU *cpu) {
+  struct Cartridge *cart = &cpu->cart;
+  uint16_t bank0 = 0;
+  uint16_t bank = cart->rom_bank;
+
+  if (cart->mapper == MAPPER_MBC1) {
+    bank |= cart->mbc1_bank2 << 5;
+    if (cart->mbc1_mode == 1) {
+      bank0 = cart->mbc1_bank2 << 5;
+    }
+  }
+
+  bank0 %= cart->rom_banks;
+  bank %= cart->rom_banks;
+  bus_map(&cpu->bus, 0x00, 0x40, cart->rom + bank0 * ROM_BANK_SIZE, NULL);
+  bus_map(&cpu->bus, 0x40, 0x40, cart->rom + bank * ROM_BANK_SIZE, NULL);
+}
+
+/* Cartridge RAM is mapped directly only when it is enabled and a whole
+ * 8 KiB bank is behind the window. MBC2 nibble RAM, the MBC3 clock
+ * registers and 2 KiB RAM always go through cartridge_read/write. */
+static void map_ram(struct CPU *cpu) {
+  struct Cartridge *cart = &cpu->cart;
+  const uint8_t bank = ram_bank(cart);
+
+  if (!cart->ram_enabled || cart->ram_banks == 0 ||
+      cart->mapper == MAPPER_MBC2 ||
+      (cart->mapper == MAPPER_MBC3 && bank >= MBC3_RTC_SELECT)) {
+    bus_map(&cpu->bus, 0xA0, 0x20, NULL, NULL);
+    return;
+  }
+
+  /* Writes to saved RAM take the slow path so they mark it dirty. */
+  uint8_t *base = cart->ram + (bank % cart->ram_banks) * RAM_BANK_SIZE;
+  bus_map(&cpu->bus, 0xA0, 0x20, base, cart->ram_saved ? NULL : base);
+}
+
+enum CartridgeError cartridge_check_header(const uint8_t *rom,
+                                           uint32_t size) {
+  if (size < HEADER_END) {
+    return CART_TOO_SMALL;
+  }
+
+  uint8_t checksum = 0;
+  for (uint16_t i = HEADER_TITLE; i < HEADER_CHECKSUM; i++) {
+    checksum = checksum - rom[i] - 1;
+  }
+  if (checksum != rom[HEADER_CHECKSUM]) {
+    return CART_BAD_CHECKSUM;
+  }
+
+  struct Cartridge cart;
+  const enum CartridgeError err = parse_type(&cart, rom[HEADER_TYPE]);
+  if (err != CART_OK) {
+    return err;
+  }
+  if (rom[HEADER_ROM_SIZE] >= ROM_SIZE_CODES) {
+    return CART_UNSUPPORTED;
+  }
+  if (size < (uint32_t)2 * ROM_BANK_SIZE << rom[HEADER_ROM_SIZE]) {
+    return CART_TOO_SMALL;
+  }
+
+  return CART_OK;
+}
+
+enum CartridgeError cartridge_map_file(const char *path, struct File *rom) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return CART_OPEN;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > UINT32_MAX) {
+    close(fd);
+    return CART_OPEN;
+  }
+
+  /* Read only and shared, so every instance running the same ROM uses the
+   * same page cache pages. The mapping outlives the descriptor. */
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return CART_OPEN;
+  }
+
+  const enum CartridgeError err = cartridge_check_header(data, st.st_size);
+  if (err != CART_OK) {
+    munmap(data, st.st_size);
+    return err;
+  }
+
+  rom->data = data;
+  rom->size = st.st_size;
+  return CART_OK;
+}
+
+void cartridge_unmap_file(struct File *rom) {
+  if (rom->data != NULL) {
+    munmap(rom->data, rom->size);
+  }
+  rom->data = NULL;
+  rom->size = 0;
+}
+
+/* Copies the save file to path.bak before a size mismatch is acted on. A
+ * backup left by an earlier run is kept as it is, being the older one. */
+static bool backup_save(int fd, const char *path) {
+  char backup[4096];
+  if (snprintf(backup, sizeof(backup), "%s.bak", path) >= (int)sizeof(backup)) {
+    return false;
+  }
+
+  const int out = open(backup, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (out < 0) {
+    return errno == EEXIST;
+  }
+
+  uint8_t chunk[4096];
+  off_t offset = 0;
+  ssize_t size;
+  bool ok = true;
+  while (ok && (size = pread(fd, chunk, sizeof(chunk), offset)) > 0) {
+    ok = write(out, chunk, size) == size;
+    offset += size;
+  }
+  ok = ok && size == 0;
+  if (close(out) != 0 || !ok) {
+    unlink(backup);
+    return false;
+  }
+  return true;
+}
+
+static enum CartridgeError map_save(struct Cartridge *cart,
+                                    const char *path) {
+  const int fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (fd < 0) {
+    return CART_SAVE;
+  }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return CART_SAVE;
+  }
+
+  /* A new file is extended and reads back as zeros. A file of another
+   * size is never shrunk: a longer one keeps its tail, such as the RTC
+   * footer other emulators add to MBC3 saves, and only its first ram_size
+   * bytes are mapped. Unless the difference is such a footer it is backed
+   * up first, and a save that cannot be backed up is refused. */
+  const off_t extra = st.st_size - (off_t)cart->ram_size;
+  const bool footer = cart->mapper == MAPPER_MBC3 &&
+                      (extra == RTC_FOOTER_SMALL || extra == RTC_FOOTER_LARGE);
+  if (st.st_size != 0 && extra != 0 && !footer && !backup_save(fd, path)) {
+    close(fd);
+    return CART_SAVE;
+  }
+  if (extra < 0 && ftruncate(fd, cart->ram_size) != 0) {
+    close(fd);
+    return CART_SAVE;
+  }
+
+  void *data =
+      mmap(NULL, cart->ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return CART_SAVE;
+  }
+
+  cart->ram = data;
+  cart->ram_saved = true;
+  return CART_OK;
+}
+
+enum CartridgeError cartridge_init(struct CPU *cpu, uint8_t *rom,
+                                   uint32_t size, const char *save_path) {
+  struct Cartridge *cart = &cpu->cart;
+
+  enum CartridgeError err = cartridge_check_header(rom, size);
+  if (err != CART_OK) {
+    return err;
+  }
+
+  *cart = (struct Cartridge){0};
+  err = parse_type(cart, rom[HEADER_TYPE]);
+  if (err != CART_OK) {
+    return err;
+  }
+
+  /* Sized from the header, trailing bytes in the file are never mapped. */
+  cart->rom = rom;
+  cart->rom_banks = 2 << rom[HEADER_ROM_SIZE];
+  cart->rom_size = cart->rom_banks * ROM_BANK_SIZE;
+  cart->rom_bank = 1;
+
+  if (cart->mapper == MAPPER_MBC2) {
+    cart->ram_size = 0x200;
+  } else if (rom[HEADER_RAM_SIZE] < 6) {
+    cart->ram_size = ram_sizes[rom[HEADER_RAM_SIZE]];
+  }
+  cart->ram_banks = cart->ram_size / RAM_BANK_SIZE;
+
+  if (cart->ram_size > 0 && cart->battery && save_path != NULL) {
+    err = map_save(cart, save_path);
+    if (err != CART_OK) {
+      return err;
+    }
+  } else if (cart->ram_size > 0) {
+    cart->ram = calloc(1, cart->ram_size);
+    if (cart->ram == NULL) {
+      return CART_ALLOC;
+    }
+  }
+
+  /* Carts without a mapper have their RAM always enabled. */
+  cart->ram_enabled = cart->mapper == MAPPER_NONE;
+
+  map_rom(cpu);
+  map_ram(cpu);
+  return CART_OK;
+}
+
+void cartridge_remap(struct CPU *cpu) {
+  map_rom(cpu);
+  map_ram(cpu);
+}
+
+void cartridge_sync(struct Cartridge *cart, bool wait) {
+  if (!cart->ram_saved || !cart->ram_dirty) {
+    return;
+  }
+  msync(cart->ram, cart->ram_size, wait ? MS_SYNC : MS_ASYNC);
+  cart->ram_dirty = false;
+}
+
+void cartridge_free(struct Cartridge *cart) {
+  if (cart->ram_saved) {
+    /* Pages an asynchronous sync has not written yet stay with the kernel
+     * after munmap, so they are not lost. */
+    cartridge_sync(cart, true);
+    munmap(cart->ram, cart->ram_size);
+  } else {
+    free(cart->ram);
+  }
+  cart->ram = NULL;
+  cart->ram_saved = false;
+}
+
+uint8_t cartridge_read(struct CPU *cpu, uint16_t address) {
+  struct Cartridge *cart = &cpu->cart;
+
+  if (!cart->ram_enabled) {
+    return 0xFF;
+  }
+
+  /* The clock is there on MBC3 carts without RAM too, e.g. type 0x0F. */
+  if (cart->mapper == MAPPER_MBC3 && cart->ram_bank >= MBC3_RTC_SELECT) {
+    return cart->ram_bank <= 0x0C ? cart->rtc[cart->ram_bank - 8] : 0xFF;
+  }
+  if (cart->ram_size == 0) {
+    return 0xFF;
+  }
+  if (cart->mapper == MAPPER_MBC2) {
+    return cart->ram[address & 0x1FF] | 0xF0;
+  }
+  return cart->ram[ram_offset(cart, address)];
+}
+
+static void write_ram(struct CPU *cpu, uint16_t address, uint8_t val) {
+  struct Cartridge *cart = &cpu->cart;
+
+  if (!cart->ram_enabled) {
+    return;
+  }
+
+  if (cart->mapper == MAPPER_MBC3 && cart->ram_bank >= MBC3_RTC_SELECT) {
+    if (cart->ram_bank <= 0x0C) {
+      cart->rtc[cart->ram_bank - 8] = val;
+    }
+    return;
+  }
+  if (cart->ram_size == 0) {
+    return;
+  }
+  cart->ram_dirty = true;
+  if (cart->mapper == MAPPER_MBC2) {
+    cart->ram[address & 0x1FF] = val & 0x0F;
+    return;
+  }
+  cart->ram[ram_offset(cart, address)] = val;
+}
+
+static void write_mbc1(struct CPU *cpu, uint16_t address, uint8_t val) {
+  struct Cartridge *cart = &cpu->cart;
+
+  switch (address >> 13) {
+  case 0:
+    cart->ram_enabled = (val & 0x0F) == 0x0A;
+    map_ram(cpu);
+    break;
+  case 1:
+    cart->rom_bank = val & 0x1F;
+    if (cart->rom_bank == 0) {
+      cart->rom_bank = 1;
+    }
+    map_rom(cpu);
+    break;
+  case 2:
+    cart->mbc1_bank2 = val & 0x03;
+    map_rom(cpu);
+    map_ram(cpu);
+    break;
+  default:
+    cart->mbc1_mode = val & 0x01;
+    map_rom(cpu);
+    map_ram(cpu);
+    break;
+  }
+}
+
+static void write_mbc2(struct CPU *cpu, uint16_t address, uint8_t val) {
+  struct Cartridge *cart = &cpu->cart;
+
+  if (address >= 0x4000) {
+    return;
+  }
+  /* Address bit 8 selects between RAM enable and ROM bank. */
+  if (address & 0x100) {
+    cart->rom_bank = val & 0x0F;
+    if (cart->rom_bank == 0) {
+      cart->rom_bank = 1;
+    }
+    map_rom(cpu);
+  } else {
+    cart->ram_enabled = (val & 0x0F) == 0x0A;
+  }
+}
+
+static void write_mbc3(struct CPU *cpu, uint16_t address, uint8_t val) {
+  struct Cartridge *cart = &cpu->cart;
+
+  switch (address >> 13) {
+  case 0:
+    cart->ram_enabled = (val & 0x0F) == 0x0A;
+    map_ram(cpu);
+    break;
+  case 1:
+    cart->rom_bank = val & 0x7F;
+    if (cart->rom_bank == 0) {
+      cart->rom_bank = 1;
+    }
+    map_rom(cpu);
+    break;
+  case 2:
+    cart->ram_bank = val & 0x0F;
+    map_ram(cpu);
+    break;
+  default:
+    /* The clock does not run, latching keeps the stored registers. */
+    cart->rtc_latch = val;
+    break;
+  }
+}
+
+static void write_mbc5(struct CPU *cpu, uint16_t address, uint8_t val) {
+  struct Cartridge *cart = &cpu->cart;
+
+  switch (address >> 12) {
+  case 0:
+  case 1:
+    cart->ram_enabled = (val & 0x0F) == 0x0A;
+    map_ram(cpu);
+    break;
+  case 2:
+    cart->rom_bank = (cart->rom_bank & 0x100) | val;
+    map_rom(cpu);
+    break;
+  case 3:
+    cart->rom_bank = (cart->rom_bank & 0xFF) | (val & 0x01) << 8;
+    map_rom(cpu);
+    break;
+  case 4:
+  case 5:
+    cart->ram_bank = val & 0x0F;
+    map_ram(cpu);
+    break;
+  default:
+    break;
+  }
+}
+
+void cartridge_write(struct CPU *cpu, uint16_t address, uint8_t val) {
+  if (address >= 0xA000) {
+    write_ram(cpu, address, val);
+    return;
+  }
+
+  switch (cpu->cart.mapper) {
+  case MAPPER_MBC1:
+    write_mbc1(cpu, address, val);
+    break;
+  case MAPPER_MBC2:
+    write_mbc2(cpu, address, val);
+    break;
+  case MAPPER_MBC3:
+    write_mbc3(cpu, address, val);
+    break;
+  case MAPPER_MBC5:
+    write_mbc5(cpu, address, val);
+    break;
+  default:
+    break;
+  }
+}
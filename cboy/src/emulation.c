@@ -1,275 +1,301 @@
-#include <SDL3/SDL_log.h>
-#include <assert.h>
-#include <cJSON.h>
 #include <emulation.h>
 #include <instruction.h>
+#include <opcodes.h>
+#include <scheduler.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-const uint32_t operand_count = 26;
-struct OperandTable operands_table[] = {
-    {"A", r8},    {"B", r8},    {"C", r8},    {"D", r8},    {"E", r8},
-    {"H", r8},    {"L", r8},    {"BC", r8},   {"DE", r16},  {"HL", r16},
-    {"n8", n8},   {"n16", n16}, {"e8", e8},   {"u3", u3},   {"Z", cc},
-    {"NZ", cc},   {"C", cc},    {"NC", cc},   {"$00", vec}, {"$08", vec},
-    {"$10", vec}, {"$18", vec}, {"$20", vec}, {"$28", vec}, {"$30", vec},
-    {"$38", vec}, {"A", R_A},   {"B", R_B},   {"C", R_C},   {"D", R_D},
-    {"E", R_E},   {"H", R_H},   {"L", R_L},   {"BC", R_BC}, {"DE", R_DE},
-    {"HL", R_HL}};
+#include <timer.h>
+
+/* Tracing goes straight to stderr, the core does not link SDL. */
+static void trace(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
 
 void log_opcode(const struct Opcode *opcode) {
-  SDL_Log("Opcode: \n");
-  SDL_Log("  hex: %X \n", opcode->val);
-  SDL_Log("  id: %s \n", opcode->id);
-  SDL_Log("  prefixed: %b \n", opcode->prefixed);
+  trace("Opcode: \n");
+  trace("  hex: %X \n", opcode->val);
+  trace("  prefixed: %b \n", opcode->prefixed);
 }
 
 void log_instruction(const struct Instruction *instruction) {
-
-  SDL_Log("\n Instruction: \n");
-
-  SDL_Log("  Opcode: \n");
-  SDL_Log("    Hex: %X \n", instruction->opcode->val);
-  SDL_Log("    Id: %s \n", instruction->opcode->id);
-  SDL_Log("    Prefixed: %b \n", instruction->opcode->prefixed);
-  if (instruction->immediate != NULL) {
-    SDL_Log("  Immediate: %b", *instruction->immediate);
-  }
-  SDL_Log("  Mnemoni: %s", instruction->mnemonic);
-  SDL_Log("  Bytes: %u", instruction->bytes);
-  SDL_Log("  Cycle count: %u", instruction->cycle_count);
-  for (uint8_t i = 0; i < instruction->cycle_count; i++) {
-    SDL_Log("  Cycle %u: %u", i + 1, instruction->cycles[i]);
-  }
-
-  SDL_Log("  Operand count: %u", instruction->operand_count);
-  for (uint8_t i = 0; i < instruction->operand_count; i++) {
-    struct Operand operand = instruction->operands[i];
-    if (operand.bytes != NULL) {
-      SDL_Log("    Operand bytes: %u", *operand.bytes);
-    }
-    if (operand.immediate != NULL) {
-      SDL_Log("    Operand immediate: %b", *operand.immediate);
-    }
-    if (operand.increment != NULL) {
-      SDL_Log("    Operand increment: %u", *operand.increment);
-    }
+  const struct OpcodeInfo *info = instruction->info;
+
+  trace("\n Instruction: \n");
+
+  trace("  Opcode: \n");
+  trace("    Hex: %X \n", instruction->opcode.val);
+  trace("    Prefixed: %b \n", instruction->opcode.prefixed);
+  trace("  Mnemoni: %s", mnemonic_names[info->mnemonic]);
+  trace("  Bytes: %u", info->bytes);
+  trace("  Cycles: %u/%u", info->cycles, info->cycles_not_taken);
+
+  trace("  Operand count: %u", info->operand_count);
+  for (uint8_t i = 0; i < info->operand_count; i++) {
+    const struct OperandInfo operand = info->operands[i];
+    trace("    Operand %s%s%s%s", operand_names[operand.name],
+          operand.flags & OPF_INDIRECT ? " indirect" : "",
+          operand.flags & OPF_INCREMENT ? " increment" : "",
+          operand.flags & OPF_DECREMENT ? " decrement" : "");
   }
+  trace("  Immediate: %X", instruction->imm);
 
-  SDL_Log("  Flag:");
-  if (instruction->flags != NULL) {
-    SDL_Log("    H: %x", instruction->flags->H[0]);
-    SDL_Log("    C: %x", instruction->flags->C[0]);
-    SDL_Log("    N: %x", instruction->flags->N[0]);
-    SDL_Log("    Z: %x", instruction->flags->Z[0]);
-  }
+  trace("  Flag:");
+  trace("    Z: %x", FLAG_EFFECT_Z(info->flags));
+  trace("    N: %x", FLAG_EFFECT_N(info->flags));
+  trace("    H: %x", FLAG_EFFECT_H(info->flags));
+  trace("    C: %x", FLAG_EFFECT_C(info->flags));
 }
 
-char *get_operand_id(enum OperandType operand) {
-  for (uint32_t i = 0; i < operand_count; i++) {
-    if (operands_table[i].operand == operand) {
-      return operands_table[i].id;
-    }
-  }
+void get_opcode(const uint8_t *rom, struct Opcode *opcode, uint16_t pc) {
+  opcode->val = rom[pc];
+  opcode->prefixed = false;
 
-  return NULL;
+  if (opcode->val == 0xCB) {
+    opcode->prefixed = true;
+    opcode->val = rom[(uint16_t)(pc + 1)];
+  }
 }
 
-enum OperandType get_operand_val(char *operand_name) {
-  for (uint32_t i = 0; i < operand_count; i++) {
-    if (strncmp(operands_table[i].id, operand_name, strlen(operand_name)) ==
-        0) {
-      return operands_table[i].operand;
+/* Reads the n8/n16/a8/a16/e8 operand following the opcode bytes. */
+uint16_t get_immediate(const uint8_t *rom, const struct OpcodeInfo *info,
+                       uint16_t pc) {
+  for (uint8_t i = 0; i < info->operand_count; i++) {
+    switch (info->operands[i].name) {
+    case OP_N8:
+    case OP_A8:
+    case OP_E8:
+      return rom[(uint16_t)(pc + 1)];
+    case OP_N16:
+    case OP_A16:
+      return rom[(uint16_t)(pc + 1)] | rom[(uint16_t)(pc + 2)] << 8;
+    default:
+      break;
     }
   }
 
-  return NONE;
+  return 0;
 }
 
-uint8_t get_opcode(uint8_t *rom, struct Opcode *opcode, uint16_t *pc) {
-  char *opcode_str = calloc(1, 4);
-  if (opcode_str == NULL) {
-    SDL_Log("malloc error");
-    return -2;
+void decode_instruction(struct CPU *cpu, struct Instruction *instruction) {
+  uint8_t rom[3];
+  for (uint8_t i = 0; i < 3; i++) {
+    rom[i] = bus_read(cpu, cpu->registers.PC + i);
   }
 
-  const uint8_t byte = (rom + *pc)[0];
+  get_opcode(rom, &instruction->opcode, 0);
+  instruction->info =
+      &opcode_table[instruction->opcode.prefixed << 8 | instruction->opcode.val];
+  instruction->imm = get_immediate(rom, instruction->info, 0);
+}
 
-  uint16_t count = sprintf(opcode_str, "0x%02X", (uint8_t)byte);
-  if (count != 4) {
-    printf("prefix opcode error");
-    return -4;
+/* Pushes PC and jumps to the highest priority pending interrupt vector. */
+static int service_interrupt(struct CPU *cpu, uint8_t pending) {
+  uint8_t bit = 0;
+  while (((pending >> bit) & 1) == 0) {
+    bit++;
   }
-  opcode->val = byte;
-  opcode->id = opcode_str;
-
-  if (opcode->val == 0xCB) {
-    free(opcode_str);
-    opcode->id = NULL;
-    opcode->prefixed = true;
-    *pc += 1;
-    const uint8_t err = get_opcode(rom, opcode, pc);
 
-    if (err > 0) {
-      printf("prefix opcode error");
-      return -4;
-    }
-  }
+  cpu->ime = false;
+  cpu->bus.io[IF_ADDRESS & 0x7F] &= ~(1 << bit);
+  bus_write(cpu, --cpu->registers.SP, cpu->registers.PC >> 8);
+  bus_write(cpu, --cpu->registers.SP, cpu->registers.PC & 0xFF);
+  cpu->registers.PC = 0x40 + bit * 8;
 
-  return 0;
+  return 20;
 }
 
-int serialize_instruction(struct Instruction *instruction, cJSON *json) {
-  cJSON *bytes = cJSON_GetObjectItem(json, "bytes");
-  instruction->bytes = (uint8_t)cJSON_GetNumberValue(bytes);
-
-  cJSON *cycles = cJSON_GetObjectItem(json, "cycles");
-  uint8_t cycle_count = cJSON_GetArraySize(cycles);
+/* Register state the DMG boot ROM leaves behind when it jumps to 0x100. */
+void cpu_reset(struct CPU *cpu) {
+  cpu->registers.A = 0x01;
+  cpu->registers.F = 0xB0;
+  cpu->registers.BC.full = 0x0013;
+  cpu->registers.DE.full = 0x00D8;
+  cpu->registers.HL.full = 0x014D;
+  cpu->registers.SP = 0xFFFE;
+  cpu->registers.PC = 0x0100;
+  cpu->ime = false;
+  cpu->ime_pending = false;
+  cpu->halted = false;
+  cpu->halt_bug = false;
+  cpu->cycles = 0;
+  cpu->idle_cycles = 0;
+  cpu->events = 0;
+  scheduler_reset(cpu);
+  timer_reset(cpu);
+  ppu_reset(cpu);
+  apu_reset(cpu);
+}
 
-  instruction->cycles = malloc(sizeof(uint8_t) * cycle_count);
-  instruction->cycle_count = cycle_count;
+static inline int step(struct CPU *cpu) {
+  const uint8_t pending = interrupts_pending(cpu);
 
-  for (int i = 0; i < cycle_count; i++) {
-    uint8_t cycle = (uint8_t)cJSON_GetNumberValue(cycles->child);
-    instruction->cycles[i] = cycle;
-    cycles = cycles->next;
+  if (cpu->halted) {
+    if (pending == 0) {
+      /* Only an event can raise an interrupt, so sleep until the next one,
+       * rounded up to the M-cycle the wake up is seen on. */
+      const uint32_t wait = (cpu->scheduler.next - cpu->cycles + 3) & ~3u;
+      cpu->idle_cycles += wait;
+      return wait;
+    }
+    cpu->halted = false;
   }
 
-  cJSON *mnemonic = cJSON_GetObjectItem(json, "mnemonic");
-  instruction->mnemonic = cJSON_GetStringValue(mnemonic);
-
-  cJSON *immediate = cJSON_GetObjectItem(json, "immediate");
-  if (immediate != NULL) {
-    bool imme = (bool)cJSON_GetNumberValue(immediate);
-    instruction->immediate = &imme;
+  if (cpu->ime && pending != 0) {
+    return service_interrupt(cpu, pending);
   }
 
-  cJSON *operands = cJSON_GetObjectItem(json, "operand");
-  if (operands != NULL) {
-    uint8_t operand_count = cJSON_GetArraySize(operands);
-    instruction->operands = malloc(sizeof(struct Operand) * operand_count);
-    instruction->operand_count = operand_count;
-
-    for (int i = 0; i < cycle_count; i++) {
-      cJSON *j_name = cJSON_GetObjectItem(operands, "name");
-      char *name = "";
-      if (j_name != NULL) {
-        name = cJSON_GetStringValue(j_name);
-      }
-
-      cJSON *j_immediate = cJSON_GetObjectItem(operands, "immediate");
-      assert(j_immediate != NULL);
-      bool immediate = (bool)cJSON_GetNumberValue(j_immediate);
-      cJSON *j_bytes = cJSON_GetObjectItem(operands, "bytes");
-      uint8_t *bytes = NULL;
-      if (j_bytes != NULL) {
-        uint8_t b = (uint8_t)cJSON_GetNumberValue(j_immediate);
-        bytes = &b;
-      }
-
-      cJSON *j_increment = cJSON_GetObjectItem(operands, "increment");
-      int8_t *increment = NULL;
-      if (j_increment != NULL) {
-        int8_t i = (int8_t)cJSON_GetNumberValue(j_immediate);
-        increment = &i;
-      }
+  if (cpu->ime_pending) {
+    cpu->ime_pending = false;
+    cpu->ime = true;
+  }
 
-      cJSON *j_decrement = cJSON_GetObjectItem(operands, "decrement");
-      if (j_decrement != NULL) {
-        int8_t d = (int8_t)-cJSON_GetNumberValue(j_immediate);
-        increment = &d;
-      }
+#ifdef CBOY_TRACE
+  struct Instruction instruction = {NULL, {false, 0}, 0};
+  decode_instruction(cpu, &instruction);
+  log_instruction(&instruction);
+  trace("###################### \n");
+#endif
 
-      struct Operand operand = {get_operand_val(name), &immediate, bytes,
-                                increment, NULL};
+  return execute(cpu);
+}
 
-      instruction->operands[i] = operand;
-      operands = operands->next;
-    };
+/* Whether a polled address only changes in an event handler or in code
+ * an event interrupts into. DIV and TIMA count on their own and the APU
+ * and cartridge (RTC) ranges are left alone. */
+static bool event_driven(uint16_t address) {
+  if (address >= 0xFF80) {
+    return true;
   }
-
-  cJSON *flags = cJSON_GetObjectItem(json, "flags");
-  if (flags == NULL) {
-    return 0;
+  if (address >= 0xFF00) {
+    switch (address & 0x7F) {
+    case 0x00: /* joypad, set between frames */
+    case 0x02: /* SC */
+    case 0x0F: /* IF */
+    case 0x41: /* STAT */
+    case 0x44: /* LY */
+      return true;
+    default:
+      return false;
+    }
   }
-
-  instruction->flags = malloc(sizeof(struct Flags));
-
-  cJSON *Z = cJSON_GetObjectItem(flags, "Z");
-  cJSON *N = cJSON_GetObjectItem(flags, "N");
-  cJSON *H = cJSON_GetObjectItem(flags, "H");
-  cJSON *C = cJSON_GetObjectItem(flags, "C");
-
-  instruction->flags->Z = cJSON_GetStringValue(Z);
-  instruction->flags->N = cJSON_GetStringValue(N);
-  instruction->flags->H = cJSON_GetStringValue(H);
-  instruction->flags->C = cJSON_GetStringValue(C);
-
-  assert(instruction->flags->Z != NULL);
-  assert(instruction->flags->N != NULL);
-  assert(instruction->flags->H != NULL);
-  assert(instruction->flags->Z != NULL);
-
-  return 0;
+  return address >= 0xC000 && address < 0xFE00;
 }
 
-int cpu_step(struct CPU *cpu, cJSON *json) {
-  struct Opcode opcode = {false, 0, NULL};
-
-  /*uint8_t *rom = malloc(0x3FFF * 8);*/
-  /*get_bytes(cpu->bus.memory, 0x0, 0x3FFF * 8, rom);*/
+/* Recognises JR to itself and the polls
+ *   LDH A,(a8) / LD A,(a16)
+ *   CP n8 / AND n8 / BIT b,A / AND A / OR A
+ *   JR cc, back
+ * Every pass reads the same value and takes the same branch until an
+ * event fires, so whole passes that end before the next event can be
+ * counted instead of run. Interrupts are events too, unless one is
+ * already pending with IME set, which ends the loop right away. */
+void skip_idle_loop(struct CPU *cpu, uint16_t jr) {
+  const uint16_t start = cpu->registers.PC;
+  uint16_t at = start;
+  uint32_t length = 12; /* the taken JR */
+
+  if (at != jr) {
+    uint16_t address;
+    switch (bus_read(cpu, at)) {
+    case 0xF0:
+      address = 0xFF00 | bus_read(cpu, at + 1);
+      at += 2;
+      length += 12;
+      break;
+    case 0xFA:
+      address = bus_read(cpu, at + 1) | bus_read(cpu, at + 2) << 8;
+      at += 3;
+      length += 16;
+      break;
+    default:
+      return;
+    }
+    if (!event_driven(address)) {
+      return;
+    }
 
-  uint8_t err = get_opcode(cpu->bus.memory, &opcode, &cpu->registers.PC);
-  if (err > 0) {
-    SDL_LogError(0, "opcode error");
-    return -4;
+    switch (bus_read(cpu, at)) {
+    case 0xA7:
+    case 0xB7:
+      at += 1;
+      length += 4;
+      break;
+    case 0xE6:
+    case 0xFE:
+      at += 2;
+      length += 8;
+      break;
+    case 0xCB:
+      if ((bus_read(cpu, at + 1) & 0xC7) != 0x47) {
+        return;
+      }
+      at += 2;
+      length += 8;
+      break;
+    default:
+      return;
+    }
+    if (at != jr) {
+      return;
+    }
   }
 
-  if (opcode.prefixed == true) {
-    json = cJSON_GetObjectItem(json, "cbprefixed");
-  } else {
-    json = cJSON_GetObjectItem(json, "unprefixed");
+  if ((cpu->ime || cpu->ime_pending) && interrupts_pending(cpu)) {
+    return;
   }
 
-  json = cJSON_GetObjectItem(json, opcode.id);
-  struct Instruction instruction = {NULL, NULL, NULL, 0,      0,
-                                    0,    0,    NULL, &opcode};
-
-  err = serialize_instruction(&instruction, json);
-  if (err > 0) {
-    SDL_Log("Serialize error");
+  const uint64_t now = cpu->cycles + 12;
+  if (cpu->scheduler.next <= now) {
+    return;
   }
+  const uint64_t skipped = (cpu->scheduler.next - now) / length * length;
+  cpu->cycles += skipped;
+  cpu->idle_cycles += skipped;
+}
 
-  log_instruction(&instruction);
-  SDL_Log("###################### \n");
-
-  if (strncmp(instruction.mnemonic, "LD", 2) == 0) {
-    ld(&instruction, cpu);
+int cpu_step(struct CPU *cpu) {
+  const uint64_t start = cpu->cycles;
+  cpu->cycles += step(cpu);
+  if (cpu->cycles >= cpu->scheduler.next) {
+    scheduler_run(cpu);
   }
+  return cpu->cycles - start;
+}
 
-  if (strncmp(instruction.mnemonic, "LDH", 3) == 0) {
-    ldh(&instruction, cpu);
+/* Nothing else runs between instructions: the clocks alongside the CPU
+ * only get a look in when their next event is due. */
+uint32_t cpu_run(struct CPU *cpu, uint32_t cycle_budget) {
+  const uint64_t start = cpu->cycles;
+  const uint64_t end = start + cycle_budget;
+
+  cpu->events = 0;
+  while (cpu->cycles < end && cpu->events == 0) {
+    /* IO writes can move the next event closer, so it is read every time
+     * round. */
+    while (cpu->cycles < cpu->scheduler.next && cpu->cycles < end) {
+      cpu->cycles += step(cpu);
+    }
+    scheduler_run(cpu);
   }
 
-  if (strncmp(instruction.mnemonic, "JP", 2) == 0) {
-    assert(instruction.operand_count <= 2);
-    ldh(&instruction, cpu);
-  }
+  return cpu->cycles - start;
+}
 
-  switch (instruction.opcode->val) {
-  case 0xE9:
-    // jump(EMPTY, cpu, cpu->registers.HL.full);
-    break;
-  default:
-    // STOP
-    // noop
-    break;
-  }
-  cpu->registers.PC += instruction.bytes;
+uint32_t run_frame(struct CPU *cpu) {
+  uint32_t cycles = 0;
 
-  return 0;
+  do {
+    cycles += cpu_run(cpu, CYCLES_PER_FRAME);
+  } while ((cpu->events & EVENT_VBLANK) == 0);
+
+  apu_end_frame(cpu);
+  cartridge_sync(&cpu->cart, false);
+  return cycles;
 }
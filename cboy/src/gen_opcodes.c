@@ -0,0 +1,252 @@
+#include <cJSON.h>
+#include <opcodes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Build time tool: turns opcodes.json into opcode_table.c.
+ * Usage: gen_opcodes <opcodes.json> <opcode_table.c> */
+
+#define MNEMONIC_STR(name) #name,
+static const char *const mnemonics[MN_COUNT] = {MNEMONICS(MNEMONIC_STR)};
+#undef MNEMONIC_STR
+
+#define OPERAND_STR(name, str) str,
+static const char *const operands[OP_COUNT] = {OPERANDS(OPERAND_STR)};
+#undef OPERAND_STR
+
+#define OPERAND_ID(name, str) "OP_" #name,
+static const char *const operand_ids[OP_COUNT] = {OPERANDS(OPERAND_ID)};
+#undef OPERAND_ID
+
+static char *read_text(const char *path, long *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) != 0) {
+    fclose(file);
+    return NULL;
+  }
+  *size = ftell(file);
+  rewind(file);
+
+  char *data = calloc(1, *size + 1);
+  if (data == NULL || fread(data, 1, *size, file) != (size_t)*size) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+static int parse_mnemonic(const char *name) {
+  if (strncmp(name, "ILLEGAL", 7) == 0) {
+    return MN_ILLEGAL;
+  }
+  for (int i = 0; i < MN_COUNT; i++) {
+    if (strcmp(mnemonics[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool is_branch(int mnemonic) {
+  return mnemonic == MN_JR || mnemonic == MN_JP || mnemonic == MN_CALL ||
+         mnemonic == MN_RET;
+}
+
+static int parse_operand(const char *name, int mnemonic, uint8_t index,
+                         uint8_t *value) {
+  *value = 0;
+  if (name[0] == '$') {
+    *value = (uint8_t)strtol(name + 1, NULL, 16);
+    return OP_VEC;
+  }
+  if (name[0] >= '0' && name[0] <= '7' && name[1] == '\0') {
+    *value = (uint8_t)(name[0] - '0');
+    return OP_U3;
+  }
+  /* The first operand of a conditional branch is the condition. */
+  if (is_branch(mnemonic) && index == 0) {
+    for (int i = OP_COND_Z; i <= OP_COND_NC; i++) {
+      if (strcmp(operands[i], name) == 0) {
+        return i;
+      }
+    }
+  }
+  for (int i = OP_NONE + 1; i < OP_COND_Z; i++) {
+    if (strcmp(operands[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static uint8_t parse_flag(const char *flag) {
+  if (flag == NULL || strcmp(flag, "-") == 0) {
+    return FLAG_UNCHANGED;
+  }
+  if (strcmp(flag, "0") == 0) {
+    return FLAG_RESET;
+  }
+  if (strcmp(flag, "1") == 0) {
+    return FLAG_SET;
+  }
+  return FLAG_AFFECTED;
+}
+
+static void append_flag(char *flags, const char *flag) {
+  if (flags[0] != '\0') {
+    strcat(flags, " | ");
+  }
+  strcat(flags, flag);
+}
+
+static int emit_entry(FILE *out, const cJSON *entry, uint16_t index) {
+  const char *name =
+      cJSON_GetStringValue(cJSON_GetObjectItem(entry, "mnemonic"));
+  int mnemonic = name != NULL ? parse_mnemonic(name) : -1;
+  if (mnemonic < 0) {
+    fprintf(stderr, "gen_opcodes: unknown mnemonic at 0x%03X\n", index);
+    return -1;
+  }
+
+  uint8_t bytes =
+      (uint8_t)cJSON_GetNumberValue(cJSON_GetObjectItem(entry, "bytes"));
+
+  const cJSON *cycles = cJSON_GetObjectItem(entry, "cycles");
+  uint8_t taken = (uint8_t)cJSON_GetNumberValue(cJSON_GetArrayItem(cycles, 0));
+  uint8_t not_taken = taken;
+  if (cJSON_GetArraySize(cycles) > 1) {
+    not_taken = (uint8_t)cJSON_GetNumberValue(cJSON_GetArrayItem(cycles, 1));
+  }
+
+  const cJSON *flags = cJSON_GetObjectItem(entry, "flags");
+  uint8_t effects = 0;
+  const char *flag_names[4] = {"Z", "N", "H", "C"};
+  for (int i = 0; i < 4; i++) {
+    effects = (uint8_t)(effects << 2);
+    effects |= parse_flag(
+        cJSON_GetStringValue(cJSON_GetObjectItem(flags, flag_names[i])));
+  }
+
+  const cJSON *list = cJSON_GetObjectItem(entry, "operands");
+  int count = cJSON_GetArraySize(list);
+  if (count > 3) {
+    fprintf(stderr, "gen_opcodes: too many operands at 0x%03X\n", index);
+    return -1;
+  }
+
+  fprintf(out, "    /* 0x%03X */ {MN_%s, %u, %u, %u, 0x%02X, %d, {", index,
+          mnemonics[mnemonic], bytes, taken, not_taken, effects, count);
+  for (int i = 0; i < count; i++) {
+    const cJSON *operand = cJSON_GetArrayItem(list, i);
+    const char *operand_name =
+        cJSON_GetStringValue(cJSON_GetObjectItem(operand, "name"));
+    uint8_t value = 0;
+    int id = operand_name != NULL
+                 ? parse_operand(operand_name, mnemonic, (uint8_t)i, &value)
+                 : -1;
+    if (id < 0) {
+      fprintf(stderr, "gen_opcodes: unknown operand at 0x%03X\n", index);
+      return -1;
+    }
+
+    char operand_flags[64] = "";
+    if (!cJSON_IsTrue(cJSON_GetObjectItem(operand, "immediate"))) {
+      append_flag(operand_flags, "OPF_INDIRECT");
+    }
+    if (cJSON_IsTrue(cJSON_GetObjectItem(operand, "increment"))) {
+      append_flag(operand_flags, "OPF_INCREMENT");
+    }
+    if (cJSON_IsTrue(cJSON_GetObjectItem(operand, "decrement"))) {
+      append_flag(operand_flags, "OPF_DECREMENT");
+    }
+    if (operand_flags[0] == '\0') {
+      strcpy(operand_flags, "0");
+    }
+
+    fprintf(out, "%s{%s, %s, 0x%02X}", i > 0 ? ", " : "", operand_ids[id],
+            operand_flags, value);
+  }
+  fprintf(out, "}},\n");
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  enum Errors { OK, WRONG_ARG, READ_FILE, PARSE_JSON, WRITE_FILE };
+  if (argc != 3) {
+    fprintf(stderr, "usage: gen_opcodes <opcodes.json> <output.c>\n");
+    return WRONG_ARG;
+  }
+
+  long size = 0;
+  char *text = read_text(argv[1], &size);
+  if (text == NULL) {
+    fprintf(stderr, "gen_opcodes: cannot read %s\n", argv[1]);
+    return READ_FILE;
+  }
+
+  cJSON *json = cJSON_ParseWithLength(text, size);
+  free(text);
+  if (json == NULL) {
+    fprintf(stderr, "gen_opcodes: cannot parse %s\n", argv[1]);
+    return PARSE_JSON;
+  }
+
+  FILE *out = fopen(argv[2], "w");
+  if (out == NULL) {
+    cJSON_Delete(json);
+    fprintf(stderr, "gen_opcodes: cannot write %s\n", argv[2]);
+    return WRITE_FILE;
+  }
+
+  fprintf(out, "/* Generated by gen_opcodes from opcodes.json. Do not edit. */\n"
+               "#include <opcodes.h>\n\n");
+
+  fprintf(out, "const char *const mnemonic_names[MN_COUNT] = {\n");
+  for (int i = 0; i < MN_COUNT; i++) {
+    fprintf(out, "    \"%s\",\n", mnemonics[i]);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "const char *const operand_names[OP_COUNT] = {\n");
+  for (int i = 0; i < OP_COUNT; i++) {
+    fprintf(out, "    \"%s\",\n", operands[i]);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "const struct OpcodeInfo opcode_table[512] = {\n");
+  const char *groups[2] = {"unprefixed", "cbprefixed"};
+  int err = OK;
+  for (uint16_t index = 0; index < 512 && err == OK; index++) {
+    char id[8];
+    snprintf(id, sizeof(id), "0x%02X", index & 0xFF);
+    const cJSON *entry =
+        cJSON_GetObjectItem(cJSON_GetObjectItem(json, groups[index >> 8]), id);
+    if (entry == NULL) {
+      fprintf(stderr, "gen_opcodes: missing opcode %s %s\n", groups[index >> 8],
+              id);
+      err = PARSE_JSON;
+      break;
+    }
+    if (emit_entry(out, entry, index) != 0) {
+      err = PARSE_JSON;
+    }
+  }
+  fprintf(out, "};\n");
+
+  cJSON_Delete(json);
+  if (fclose(out) != 0 && err == OK) {
+    err = WRITE_FILE;
+  }
+  if (err != OK) {
+    remove(argv[2]);
+  }
+  return err;
+}
@@ -0,0 +1,154 @@
+#include <emulation.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Frontend without SDL for servers and CI. Runs a ROM for a fixed number
+ * of frames or cycles and writes out whatever was asked for. Battery RAM
+ * is never saved, so runs are repeatable. */
+
+static const char usage[] =
+    "usage: cboy-headless --rom <rom.gb> [--frames N | --cycles N]\n"
+    "                     [--dump-ram <file>] [--screenshot <file.ppm>]\n"
+    "                     [--serial-out <file|->]\n"
+    "  --frames N      run N frames, 60 if neither limit is given\n"
+    "  --cycles N      run until N T-cycles have passed\n"
+    "  --dump-ram      write WRAM (0xC000-0xDFFF) then HRAM (0xFF80-0xFFFE)\n"
+    "  --screenshot    write the last frame as a binary PPM\n"
+    "  --serial-out    write bytes sent over the link port\n";
+
+/* Shades 0-3 of the framebuffer, the same greys as the SDL frontend. */
+static const uint8_t shades[4] = {0xFF, 0xAA, 0x55, 0x00};
+
+static void write_serial(void *user, uint8_t byte) {
+  FILE *out = user;
+  fputc(byte, out);
+  fflush(out);
+}
+
+static bool dump_ram(const struct CPU *cpu, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  const bool ok =
+      fwrite(cpu->bus.wram, sizeof(cpu->bus.wram), 1, file) == 1 &&
+      fwrite(cpu->bus.hram, sizeof(cpu->bus.hram), 1, file) == 1;
+  return fclose(file) == 0 && ok;
+}
+
+static bool screenshot(const struct CPU *cpu, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+  for (uint8_t y = 0; y < SCREEN_HEIGHT; y++) {
+    uint8_t row[SCREEN_WIDTH * 3];
+    for (uint8_t x = 0; x < SCREEN_WIDTH; x++) {
+      memset(row + x * 3, shades[cpu->screen.framebuffer[y][x]], 3);
+    }
+    fwrite(row, sizeof(row), 1, file);
+  }
+  return fclose(file) == 0;
+}
+
+int main(const int argc, char *argv[]) {
+  enum Errors { OK, WRONG_ARG, READ_FILE, WRITE_FILE };
+  const char *rom_path = NULL;
+  const char *ram_path = NULL;
+  const char *screenshot_path = NULL;
+  const char *serial_path = NULL;
+  uint64_t frames = 60;
+  uint64_t cycles = 0;
+
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      fputs(usage, stderr);
+      return WRONG_ARG;
+    }
+    if (strcmp(argv[i], "--rom") == 0) {
+      rom_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      frames = strtoull(argv[i + 1], NULL, 10);
+      cycles = 0;
+    } else if (strcmp(argv[i], "--cycles") == 0) {
+      cycles = strtoull(argv[i + 1], NULL, 10);
+      frames = 0;
+    } else if (strcmp(argv[i], "--dump-ram") == 0) {
+      ram_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--screenshot") == 0) {
+      screenshot_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--serial-out") == 0) {
+      serial_path = argv[i + 1];
+    } else {
+      fputs(usage, stderr);
+      return WRONG_ARG;
+    }
+  }
+  if (rom_path == NULL) {
+    fputs(usage, stderr);
+    return WRONG_ARG;
+  }
+
+  static struct CPU cpu;
+  struct File rom = {NULL, 0};
+  uint32_t err = cartridge_map_file(rom_path, &rom);
+  if (err != CART_OK) {
+    fprintf(stderr, "Error with reading *.gb: %u\n", err);
+    return READ_FILE;
+  }
+
+  bus_init(&cpu.bus);
+  err = cartridge_init(&cpu, rom.data, rom.size, NULL);
+  if (err != CART_OK) {
+    cartridge_unmap_file(&rom);
+    fprintf(stderr, "Unsupported cartridge: %u\n", err);
+    return READ_FILE;
+  }
+  cpu_reset(&cpu);
+  /* Nobody looks at frames that are not written out. */
+  ppu_set_render_interval(&cpu, screenshot_path != NULL ? 1 : 0);
+
+  FILE *serial = NULL;
+  if (serial_path != NULL) {
+    serial = strcmp(serial_path, "-") == 0 ? stdout : fopen(serial_path, "wb");
+    if (serial == NULL) {
+      fprintf(stderr, "Cannot open %s\n", serial_path);
+      cartridge_free(&cpu.cart);
+      cartridge_unmap_file(&rom);
+      return WRITE_FILE;
+    }
+    cpu.serial.out = write_serial;
+    cpu.serial.user = serial;
+  }
+
+  for (uint64_t frame = 0; frame < frames; frame++) {
+    run_frame(&cpu);
+  }
+  while (cpu.cycles < cycles) {
+    const uint64_t left = cycles - cpu.cycles;
+    cpu_run(&cpu, left < CYCLES_PER_FRAME ? (uint32_t)left : CYCLES_PER_FRAME);
+  }
+
+  enum Errors result = OK;
+  if (ram_path != NULL && !dump_ram(&cpu, ram_path)) {
+    fprintf(stderr, "Cannot write %s\n", ram_path);
+    result = WRITE_FILE;
+  }
+  if (screenshot_path != NULL && !screenshot(&cpu, screenshot_path)) {
+    fprintf(stderr, "Cannot write %s\n", screenshot_path);
+    result = WRITE_FILE;
+  }
+  if (serial != NULL && serial != stdout) {
+    fclose(serial);
+  }
+
+  cartridge_free(&cpu.cart);
+  cartridge_unmap_file(&rom);
+  return result;
+}
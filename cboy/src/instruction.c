@@ -1,238 +1,871 @@
-#include "SDL3/SDL_log.h"
-#include <assert.h>
-#include <cJSON.h>
 #include <emulation.h>
+#include <instruction.h>
+#include <opcodes.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdlib.h>
-
-bool is_condition_set(const enum OperandType condition, struct CPU *cpu) {
-  switch (condition) {
-  case C:
-    return ((cpu->registers.F << 4) & 1) == 1;
-  case NC:
-    return ((cpu->registers.F << 4) & 1) == 0;
-  case Z:
-    return ((cpu->registers.F << 7) & 1) == 1;
-  case NZ:
-    return ((cpu->registers.F << 7) & 1) == 0;
-  default:
-    assert(true);
-    return true;
-  }
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+/* Register operands by their 3 bit encoding. The union halves are laid out
+ * little endian, so the high register of a pair is half[1]. */
+#define R_A cpu->registers.A
+#define R_F cpu->registers.F
+#define R_B cpu->registers.BC.half[1]
+#define R_C cpu->registers.BC.half[0]
+#define R_D cpu->registers.DE.half[1]
+#define R_E cpu->registers.DE.half[0]
+#define R_H cpu->registers.HL.half[1]
+#define R_L cpu->registers.HL.half[0]
+#define R_BC cpu->registers.BC.full
+#define R_DE cpu->registers.DE.full
+#define R_HL cpu->registers.HL.full
+#define R_SP cpu->registers.SP
+#define R_PC cpu->registers.PC
+
+static inline uint8_t fetch8(struct CPU *cpu) {
+  return bus_read(cpu, R_PC++);
 }
 
-void jump(const enum OperandType condition, struct CPU *cpu,
-          const uint16_t n16) {
-  if (condition == NONE || is_condition_set(condition, cpu)) {
-    cpu->registers.PC = n16;
-    return;
-  }
+static inline uint16_t fetch16(struct CPU *cpu) {
+  const uint16_t lo = fetch8(cpu);
+  return lo | fetch8(cpu) << 8;
+}
+
+static inline void push(struct CPU *cpu, uint16_t val) {
+  bus_write(cpu, --R_SP, val >> 8);
+  bus_write(cpu, --R_SP, val & 0xFF);
+}
+
+static inline uint16_t pop(struct CPU *cpu) {
+  const uint16_t lo = bus_read(cpu, R_SP++);
+  return lo | bus_read(cpu, R_SP++) << 8;
 }
 
-void jump_relative(const enum OperandType condition, struct CPU *cpu,
-                   const void *n16) {
-  if (condition == NONE || is_condition_set(condition, cpu)) {
-    cpu->registers.PC += *(int8_t *)n16;
-    return;
+static inline void jump_relative(struct CPU *cpu, uint8_t e8) {
+  R_PC += (int8_t)e8;
+  /* Up to seven bytes back may close a polling loop. */
+  if (e8 >= 0xF9) {
+    skip_idle_loop(cpu, R_PC - (int8_t)e8 - 2);
   }
 }
 
-void push(struct CPU *cpu, uint16_t *val) {
-  cpu->registers.SP += 0x02;
-  cpu->bus.memory[cpu->registers.SP] = *val;
+static inline void call(struct CPU *cpu, uint16_t n16) {
+  push(cpu, R_PC);
+  R_PC = n16;
+}
+
+static inline uint8_t inc8(struct CPU *cpu, uint8_t val) {
+  const uint8_t res = val + 1;
+  R_F = (R_F & FLAG_C) | (res == 0 ? FLAG_Z : 0) |
+        ((res & 0x0F) == 0 ? FLAG_H : 0);
+  return res;
 }
 
-void rst(struct CPU *cpu, uint8_t id) {
-  push(cpu, &cpu->registers.PC);
-  SDL_Log("%d", id);
+static inline uint8_t dec8(struct CPU *cpu, uint8_t val) {
+  const uint8_t res = val - 1;
+  R_F = (R_F & FLAG_C) | FLAG_N | (res == 0 ? FLAG_Z : 0) |
+        ((res & 0x0F) == 0x0F ? FLAG_H : 0);
+  return res;
 }
 
-void load_r8(uint8_t *target, uint8_t val) { *target = val; }
+static inline void add_hl(struct CPU *cpu, uint16_t val) {
+  const uint32_t res = R_HL + val;
+  R_F = (R_F & FLAG_Z) |
+        (((R_HL & 0x0FFF) + (val & 0x0FFF)) > 0x0FFF ? FLAG_H : 0) |
+        (res > 0xFFFF ? FLAG_C : 0);
+  R_HL = (uint16_t)res;
+}
 
-void load(void *target, void *val) { *(char *)target = *(char *)val; }
+/* SP+e8 for ADD SP,e8 and LD HL,SP+e8: carries come from the low byte. */
+static inline uint16_t add_sp(struct CPU *cpu, uint8_t e8) {
+  R_F = (((R_SP & 0x0F) + (e8 & 0x0F)) > 0x0F ? FLAG_H : 0) |
+        (((R_SP & 0xFF) + e8) > 0xFF ? FLAG_C : 0);
+  return R_SP + (int8_t)e8;
+}
 
-void *get_reg(struct CPU *cpu, enum OperandType reg_type) {
-  switch (reg_type) {
-  case R_A:
-    return &cpu->registers.A;
-  case R_B:
-    return &cpu->registers.BC.half[0];
-  case R_C:
-    return &cpu->registers.BC.half[1];
-  case R_D:
-    return &cpu->registers.DE.half[0];
-  case R_E:
-    return &cpu->registers.DE.half[1];
-  case R_H:
-    return &cpu->registers.HL.half[0];
-  case R_L:
-    return &cpu->registers.HL.half[1];
-  case R_BC:
-    return &cpu->registers.BC.full;
-  case R_DE:
-    return &cpu->registers.DE.full;
-  case R_HL:
-    return &cpu->registers.HL.full;
-  default:
-    return NULL;
-  }
+static inline void alu_add(struct CPU *cpu, uint8_t val, uint8_t carry) {
+  const uint16_t res = R_A + val + carry;
+  R_F = ((res & 0xFF) == 0 ? FLAG_Z : 0) |
+        (((R_A & 0x0F) + (val & 0x0F) + carry) > 0x0F ? FLAG_H : 0) |
+        (res > 0xFF ? FLAG_C : 0);
+  R_A = (uint8_t)res;
+}
 
-  return NULL;
+static inline uint8_t alu_sub(struct CPU *cpu, uint8_t val, uint8_t carry) {
+  const int16_t res = R_A - val - carry;
+  R_F = FLAG_N | ((res & 0xFF) == 0 ? FLAG_Z : 0) |
+        (((R_A & 0x0F) - (val & 0x0F) - carry) < 0 ? FLAG_H : 0) |
+        (res < 0 ? FLAG_C : 0);
+  return (uint8_t)res;
+}
+
+#define CARRY ((R_F & FLAG_C) ? 1 : 0)
+
+static inline void op_add(struct CPU *cpu, uint8_t val) {
+  alu_add(cpu, val, 0);
+}
+static inline void op_adc(struct CPU *cpu, uint8_t val) {
+  alu_add(cpu, val, CARRY);
+}
+static inline void op_sub(struct CPU *cpu, uint8_t val) {
+  R_A = alu_sub(cpu, val, 0);
+}
+static inline void op_sbc(struct CPU *cpu, uint8_t val) {
+  R_A = alu_sub(cpu, val, CARRY);
+}
+static inline void op_cp(struct CPU *cpu, uint8_t val) {
+  alu_sub(cpu, val, 0);
+}
+static inline void op_and(struct CPU *cpu, uint8_t val) {
+  R_A &= val;
+  R_F = (R_A == 0 ? FLAG_Z : 0) | FLAG_H;
+}
+static inline void op_xor(struct CPU *cpu, uint8_t val) {
+  R_A ^= val;
+  R_F = R_A == 0 ? FLAG_Z : 0;
+}
+static inline void op_or(struct CPU *cpu, uint8_t val) {
+  R_A |= val;
+  R_F = R_A == 0 ? FLAG_Z : 0;
 }
 
-void ld(struct Instruction *instruction, struct CPU *cpu) {
-  assert(instruction->operand_count == 2);
-  struct Operand operand1 = instruction->operands[0];
-  struct Operand operand2 = instruction->operands[1];
+static inline void daa(struct CPU *cpu) {
+  uint8_t adjust = 0;
+  bool carry = R_F & FLAG_C;
 
-  if (operand1.increment != NULL) {
-    if (operand1.type == R_HL && operand2.type == R_A) {
-      load(&cpu->registers.HL.full, &cpu->registers.A);
-      cpu->registers.HL.full += *instruction->operands->increment;
-      return;
+  if (R_F & FLAG_N) {
+    if (R_F & FLAG_H) {
+      adjust |= 0x06;
     }
-    assert(operand1.type == R_HL && operand2.type == R_A);
-    load(&cpu->registers.A, &cpu->registers.HL.full);
-    cpu->registers.HL.full += *instruction->operands->increment;
-    return;
+    if (carry) {
+      adjust |= 0x60;
+    }
+    R_A -= adjust;
+  } else {
+    if ((R_F & FLAG_H) || (R_A & 0x0F) > 0x09) {
+      adjust |= 0x06;
+    }
+    if (carry || R_A > 0x99) {
+      adjust |= 0x60;
+      carry = true;
+    }
+    R_A += adjust;
   }
+  R_F = (R_A == 0 ? FLAG_Z : 0) | (R_F & FLAG_N) | (carry ? FLAG_C : 0);
+}
 
-  if (operand2.increment != NULL) {
-    load(&cpu->registers.HL.full, &cpu->registers.A);
-    cpu->registers.HL.full += *instruction->operands->increment;
-    return;
-  }
+/* CB-prefixed rotates and shifts. */
+static inline uint8_t shift_flags(struct CPU *cpu, uint8_t res, bool carry) {
+  R_F = (res == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0);
+  return res;
+}
+static inline uint8_t op_rlc(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)(val << 1 | val >> 7), val & 0x80);
+}
+static inline uint8_t op_rrc(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)(val >> 1 | val << 7), val & 0x01);
+}
+static inline uint8_t op_rl(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)(val << 1 | CARRY), val & 0x80);
+}
+static inline uint8_t op_rr(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)(val >> 1 | CARRY << 7), val & 0x01);
+}
+static inline uint8_t op_sla(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)(val << 1), val & 0x80);
+}
+static inline uint8_t op_sra(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)((val >> 1) | (val & 0x80)), val & 0x01);
+}
+static inline uint8_t op_swap(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, (uint8_t)(val << 4 | val >> 4), false);
+}
+static inline uint8_t op_srl(struct CPU *cpu, uint8_t val) {
+  return shift_flags(cpu, val >> 1, val & 0x01);
+}
+static inline void op_bit(struct CPU *cpu, uint8_t bit, uint8_t val) {
+  R_F = (R_F & FLAG_C) | FLAG_H | ((val >> bit) & 1 ? 0 : FLAG_Z);
+}
 
-  if (operand1.type == r8 && operand2.type == r8) {
-    load(get_reg(cpu, operand1.type), get_reg(cpu, operand2.type));
-    return;
+/* One case per register operand, in encoding order B C D E H L (HL) A. */
+#define LD_ROW(base, dst)                                                      \
+  case base + 0:                                                               \
+    dst = R_B;                                                                 \
+    break;                                                                     \
+  case base + 1:                                                               \
+    dst = R_C;                                                                 \
+    break;                                                                     \
+  case base + 2:                                                               \
+    dst = R_D;                                                                 \
+    break;                                                                     \
+  case base + 3:                                                               \
+    dst = R_E;                                                                 \
+    break;                                                                     \
+  case base + 4:                                                               \
+    dst = R_H;                                                                 \
+    break;                                                                     \
+  case base + 5:                                                               \
+    dst = R_L;                                                                 \
+    break;                                                                     \
+  case base + 6:                                                               \
+    dst = bus_read(cpu, R_HL);                                                 \
+    break;                                                                     \
+  case base + 7:                                                               \
+    dst = R_A;                                                                 \
+    break;
+
+#define ALU_ROW(base, fn)                                                      \
+  case base + 0:                                                               \
+    fn(cpu, R_B);                                                              \
+    break;                                                                     \
+  case base + 1:                                                               \
+    fn(cpu, R_C);                                                              \
+    break;                                                                     \
+  case base + 2:                                                               \
+    fn(cpu, R_D);                                                              \
+    break;                                                                     \
+  case base + 3:                                                               \
+    fn(cpu, R_E);                                                              \
+    break;                                                                     \
+  case base + 4:                                                               \
+    fn(cpu, R_H);                                                              \
+    break;                                                                     \
+  case base + 5:                                                               \
+    fn(cpu, R_L);                                                              \
+    break;                                                                     \
+  case base + 6:                                                               \
+    fn(cpu, bus_read(cpu, R_HL));                                              \
+    break;                                                                     \
+  case base + 7:                                                               \
+    fn(cpu, R_A);                                                              \
+    break;
+
+#define CB_ROW(base, fn)                                                       \
+  case base + 0:                                                               \
+    R_B = fn(cpu, R_B);                                                        \
+    break;                                                                     \
+  case base + 1:                                                               \
+    R_C = fn(cpu, R_C);                                                        \
+    break;                                                                     \
+  case base + 2:                                                               \
+    R_D = fn(cpu, R_D);                                                        \
+    break;                                                                     \
+  case base + 3:                                                               \
+    R_E = fn(cpu, R_E);                                                        \
+    break;                                                                     \
+  case base + 4:                                                               \
+    R_H = fn(cpu, R_H);                                                        \
+    break;                                                                     \
+  case base + 5:                                                               \
+    R_L = fn(cpu, R_L);                                                        \
+    break;                                                                     \
+  case base + 6:                                                               \
+    bus_write(cpu, R_HL, fn(cpu, bus_read(cpu, R_HL)));                        \
+    break;                                                                     \
+  case base + 7:                                                               \
+    R_A = fn(cpu, R_A);                                                        \
+    break;
+
+#define BIT_ROW(base, bit)                                                     \
+  case base + 0:                                                               \
+    op_bit(cpu, bit, R_B);                                                     \
+    break;                                                                     \
+  case base + 1:                                                               \
+    op_bit(cpu, bit, R_C);                                                     \
+    break;                                                                     \
+  case base + 2:                                                               \
+    op_bit(cpu, bit, R_D);                                                     \
+    break;                                                                     \
+  case base + 3:                                                               \
+    op_bit(cpu, bit, R_E);                                                     \
+    break;                                                                     \
+  case base + 4:                                                               \
+    op_bit(cpu, bit, R_H);                                                     \
+    break;                                                                     \
+  case base + 5:                                                               \
+    op_bit(cpu, bit, R_L);                                                     \
+    break;                                                                     \
+  case base + 6:                                                               \
+    op_bit(cpu, bit, bus_read(cpu, R_HL));                                     \
+    break;                                                                     \
+  case base + 7:                                                               \
+    op_bit(cpu, bit, R_A);                                                     \
+    break;
+
+/* RES is "&= ~(1 << bit)", SET is "|= (1 << bit)". */
+#define MASK_ROW(base, op, mask)                                               \
+  case base + 0:                                                               \
+    R_B op mask;                                                               \
+    break;                                                                     \
+  case base + 1:                                                               \
+    R_C op mask;                                                               \
+    break;                                                                     \
+  case base + 2:                                                               \
+    R_D op mask;                                                               \
+    break;                                                                     \
+  case base + 3:                                                               \
+    R_E op mask;                                                               \
+    break;                                                                     \
+  case base + 4:                                                               \
+    R_H op mask;                                                               \
+    break;                                                                     \
+  case base + 5:                                                               \
+    R_L op mask;                                                               \
+    break;                                                                     \
+  case base + 6: {                                                             \
+    uint8_t val = bus_read(cpu, R_HL);                                         \
+    val op mask;                                                               \
+    bus_write(cpu, R_HL, val);                                                 \
+    break;                                                                     \
+  }                                                                            \
+  case base + 7:                                                               \
+    R_A op mask;                                                               \
+    break;
+
+static uint8_t execute_cb(struct CPU *cpu) {
+  const uint8_t op = fetch8(cpu);
+
+  switch (op) {
+    CB_ROW(0x00, op_rlc)
+    CB_ROW(0x08, op_rrc)
+    CB_ROW(0x10, op_rl)
+    CB_ROW(0x18, op_rr)
+    CB_ROW(0x20, op_sla)
+    CB_ROW(0x28, op_sra)
+    CB_ROW(0x30, op_swap)
+    CB_ROW(0x38, op_srl)
+    BIT_ROW(0x40, 0)
+    BIT_ROW(0x48, 1)
+    BIT_ROW(0x50, 2)
+    BIT_ROW(0x58, 3)
+    BIT_ROW(0x60, 4)
+    BIT_ROW(0x68, 5)
+    BIT_ROW(0x70, 6)
+    BIT_ROW(0x78, 7)
+    MASK_ROW(0x80, &=, (uint8_t)~0x01)
+    MASK_ROW(0x88, &=, (uint8_t)~0x02)
+    MASK_ROW(0x90, &=, (uint8_t)~0x04)
+    MASK_ROW(0x98, &=, (uint8_t)~0x08)
+    MASK_ROW(0xA0, &=, (uint8_t)~0x10)
+    MASK_ROW(0xA8, &=, (uint8_t)~0x20)
+    MASK_ROW(0xB0, &=, (uint8_t)~0x40)
+    MASK_ROW(0xB8, &=, (uint8_t)~0x80)
+    MASK_ROW(0xC0, |=, 0x01)
+    MASK_ROW(0xC8, |=, 0x02)
+    MASK_ROW(0xD0, |=, 0x04)
+    MASK_ROW(0xD8, |=, 0x08)
+    MASK_ROW(0xE0, |=, 0x10)
+    MASK_ROW(0xE8, |=, 0x20)
+    MASK_ROW(0xF0, |=, 0x40)
+    MASK_ROW(0xF8, |=, 0x80)
   }
 
-  if (operand1.type == r8 && operand2.type == n8) {
-    assert(operand2.bytes != NULL);
-    load(get_reg(cpu, operand1.type),
-         &cpu->bus.memory[cpu->registers.PC + *operand2.bytes]);
-    return;
-  }
+  return opcode_table[0x100 | op].cycles;
+}
 
-  if (operand1.type == r16 && operand2.type == n16) {
-    assert(operand2.bytes != NULL);
-    load(get_reg(cpu, operand1.type),
-         &cpu->bus.memory[cpu->registers.PC + *operand2.bytes]);
-    return;
+uint8_t execute(struct CPU *cpu) {
+  const uint8_t op = bus_read(cpu, R_PC);
+  if (cpu->halt_bug) {
+    /* The byte after HALT is read twice. */
+    cpu->halt_bug = false;
+  } else {
+    R_PC++;
   }
 
-  if (operand1.type == R_HL && operand2.type == r8) {
-    load(&cpu->registers.HL.full, get_reg(cpu, operand2.type));
-    return;
+  bool taken = true;
+
+  switch (op) {
+  /* 8-bit loads */
+  case 0x02:
+    bus_write(cpu, R_BC, R_A);
+    break;
+  case 0x12:
+    bus_write(cpu, R_DE, R_A);
+    break;
+  case 0x22:
+    bus_write(cpu, R_HL++, R_A);
+    break;
+  case 0x32:
+    bus_write(cpu, R_HL--, R_A);
+    break;
+  case 0x0A:
+    R_A = bus_read(cpu, R_BC);
+    break;
+  case 0x1A:
+    R_A = bus_read(cpu, R_DE);
+    break;
+  case 0x2A:
+    R_A = bus_read(cpu, R_HL++);
+    break;
+  case 0x3A:
+    R_A = bus_read(cpu, R_HL--);
+    break;
+  case 0x06:
+    R_B = fetch8(cpu);
+    break;
+  case 0x0E:
+    R_C = fetch8(cpu);
+    break;
+  case 0x16:
+    R_D = fetch8(cpu);
+    break;
+  case 0x1E:
+    R_E = fetch8(cpu);
+    break;
+  case 0x26:
+    R_H = fetch8(cpu);
+    break;
+  case 0x2E:
+    R_L = fetch8(cpu);
+    break;
+  case 0x36:
+    bus_write(cpu, R_HL, fetch8(cpu));
+    break;
+  case 0x3E:
+    R_A = fetch8(cpu);
+    break;
+
+    LD_ROW(0x40, R_B)
+    LD_ROW(0x48, R_C)
+    LD_ROW(0x50, R_D)
+    LD_ROW(0x58, R_E)
+    LD_ROW(0x60, R_H)
+    LD_ROW(0x68, R_L)
+    LD_ROW(0x78, R_A)
+
+  case 0x70:
+    bus_write(cpu, R_HL, R_B);
+    break;
+  case 0x71:
+    bus_write(cpu, R_HL, R_C);
+    break;
+  case 0x72:
+    bus_write(cpu, R_HL, R_D);
+    break;
+  case 0x73:
+    bus_write(cpu, R_HL, R_E);
+    break;
+  case 0x74:
+    bus_write(cpu, R_HL, R_H);
+    break;
+  case 0x75:
+    bus_write(cpu, R_HL, R_L);
+    break;
+  case 0x77:
+    bus_write(cpu, R_HL, R_A);
+    break;
+
+  case 0xE0:
+    bus_write(cpu, 0xFF00 | fetch8(cpu), R_A);
+    break;
+  case 0xF0:
+    R_A = bus_read(cpu, 0xFF00 | fetch8(cpu));
+    break;
+  case 0xE2:
+    bus_write(cpu, 0xFF00 | R_C, R_A);
+    break;
+  case 0xF2:
+    R_A = bus_read(cpu, 0xFF00 | R_C);
+    break;
+  case 0xEA:
+    bus_write(cpu, fetch16(cpu), R_A);
+    break;
+  case 0xFA:
+    R_A = bus_read(cpu, fetch16(cpu));
+    break;
+
+  /* 16-bit loads */
+  case 0x01:
+    R_BC = fetch16(cpu);
+    break;
+  case 0x11:
+    R_DE = fetch16(cpu);
+    break;
+  case 0x21:
+    R_HL = fetch16(cpu);
+    break;
+  case 0x31:
+    R_SP = fetch16(cpu);
+    break;
+  case 0x08: {
+    const uint16_t address = fetch16(cpu);
+    bus_write(cpu, address, R_SP & 0xFF);
+    bus_write(cpu, address + 1, R_SP >> 8);
+    break;
   }
-
-  if (operand1.type == R_HL && operand2.type == n8) {
-    assert(operand2.bytes != NULL);
-    load(&cpu->registers.HL.full,
-         &cpu->bus.memory[cpu->registers.PC + *operand2.bytes]);
-    return;
+  case 0xF8:
+    R_HL = add_sp(cpu, fetch8(cpu));
+    break;
+  case 0xF9:
+    R_SP = R_HL;
+    break;
+  case 0xC5:
+    push(cpu, R_BC);
+    break;
+  case 0xD5:
+    push(cpu, R_DE);
+    break;
+  case 0xE5:
+    push(cpu, R_HL);
+    break;
+  case 0xF5:
+    push(cpu, R_A << 8 | R_F);
+    break;
+  case 0xC1:
+    R_BC = pop(cpu);
+    break;
+  case 0xD1:
+    R_DE = pop(cpu);
+    break;
+  case 0xE1:
+    R_HL = pop(cpu);
+    break;
+  case 0xF1: {
+    const uint16_t af = pop(cpu);
+    R_A = af >> 8;
+    R_F = af & 0xF0;
+    break;
   }
 
-  if (operand1.type == r8 && operand2.type == R_HL) {
-    assert(operand2.bytes != NULL);
-    load(&cpu->bus.memory[cpu->registers.PC + *operand2.bytes],
-         &cpu->registers.HL.full);
-    return;
+  /* 8-bit arithmetic */
+  case 0x04:
+    R_B = inc8(cpu, R_B);
+    break;
+  case 0x0C:
+    R_C = inc8(cpu, R_C);
+    break;
+  case 0x14:
+    R_D = inc8(cpu, R_D);
+    break;
+  case 0x1C:
+    R_E = inc8(cpu, R_E);
+    break;
+  case 0x24:
+    R_H = inc8(cpu, R_H);
+    break;
+  case 0x2C:
+    R_L = inc8(cpu, R_L);
+    break;
+  case 0x34:
+    bus_write(cpu, R_HL, inc8(cpu, bus_read(cpu, R_HL)));
+    break;
+  case 0x3C:
+    R_A = inc8(cpu, R_A);
+    break;
+  case 0x05:
+    R_B = dec8(cpu, R_B);
+    break;
+  case 0x0D:
+    R_C = dec8(cpu, R_C);
+    break;
+  case 0x15:
+    R_D = dec8(cpu, R_D);
+    break;
+  case 0x1D:
+    R_E = dec8(cpu, R_E);
+    break;
+  case 0x25:
+    R_H = dec8(cpu, R_H);
+    break;
+  case 0x2D:
+    R_L = dec8(cpu, R_L);
+    break;
+  case 0x35:
+    bus_write(cpu, R_HL, dec8(cpu, bus_read(cpu, R_HL)));
+    break;
+  case 0x3D:
+    R_A = dec8(cpu, R_A);
+    break;
+
+    ALU_ROW(0x80, op_add)
+    ALU_ROW(0x88, op_adc)
+    ALU_ROW(0x90, op_sub)
+    ALU_ROW(0x98, op_sbc)
+    ALU_ROW(0xA0, op_and)
+    ALU_ROW(0xA8, op_xor)
+    ALU_ROW(0xB0, op_or)
+    ALU_ROW(0xB8, op_cp)
+
+  case 0xC6:
+    op_add(cpu, fetch8(cpu));
+    break;
+  case 0xCE:
+    op_adc(cpu, fetch8(cpu));
+    break;
+  case 0xD6:
+    op_sub(cpu, fetch8(cpu));
+    break;
+  case 0xDE:
+    op_sbc(cpu, fetch8(cpu));
+    break;
+  case 0xE6:
+    op_and(cpu, fetch8(cpu));
+    break;
+  case 0xEE:
+    op_xor(cpu, fetch8(cpu));
+    break;
+  case 0xF6:
+    op_or(cpu, fetch8(cpu));
+    break;
+  case 0xFE:
+    op_cp(cpu, fetch8(cpu));
+    break;
+
+  case 0x27:
+    daa(cpu);
+    break;
+  case 0x2F:
+    R_A = ~R_A;
+    R_F |= FLAG_N | FLAG_H;
+    break;
+  case 0x37:
+    R_F = (R_F & FLAG_Z) | FLAG_C;
+    break;
+  case 0x3F:
+    R_F = (R_F & FLAG_Z) | ((R_F & FLAG_C) ^ FLAG_C);
+    break;
+
+  /* 16-bit arithmetic */
+  case 0x03:
+    R_BC++;
+    break;
+  case 0x13:
+    R_DE++;
+    break;
+  case 0x23:
+    R_HL++;
+    break;
+  case 0x33:
+    R_SP++;
+    break;
+  case 0x0B:
+    R_BC--;
+    break;
+  case 0x1B:
+    R_DE--;
+    break;
+  case 0x2B:
+    R_HL--;
+    break;
+  case 0x3B:
+    R_SP--;
+    break;
+  case 0x09:
+    add_hl(cpu, R_BC);
+    break;
+  case 0x19:
+    add_hl(cpu, R_DE);
+    break;
+  case 0x29:
+    add_hl(cpu, R_HL);
+    break;
+  case 0x39:
+    add_hl(cpu, R_SP);
+    break;
+  case 0xE8:
+    R_SP = add_sp(cpu, fetch8(cpu));
+    break;
+
+  /* Rotates on A */
+  case 0x07:
+    R_A = op_rlc(cpu, R_A);
+    R_F &= FLAG_C;
+    break;
+  case 0x0F:
+    R_A = op_rrc(cpu, R_A);
+    R_F &= FLAG_C;
+    break;
+  case 0x17:
+    R_A = op_rl(cpu, R_A);
+    R_F &= FLAG_C;
+    break;
+  case 0x1F:
+    R_A = op_rr(cpu, R_A);
+    R_F &= FLAG_C;
+    break;
+
+  /* Jumps and calls */
+  case 0xC3:
+    R_PC = fetch16(cpu);
+    break;
+  case 0xE9:
+    R_PC = R_HL;
+    break;
+  case 0xC2: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = !(R_F & FLAG_Z))) {
+      R_PC = n16;
+    }
+    break;
   }
-
-  if (operand1.type == r16 && operand2.type == R_A) {
-    load(get_reg(cpu, operand1.type), &cpu->registers.A);
-    return;
+  case 0xCA: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = R_F & FLAG_Z)) {
+      R_PC = n16;
+    }
+    break;
   }
-
-  if (operand1.type == n16 && operand2.type == R_A) {
-    assert(operand1.bytes != NULL);
-    load(&cpu->bus.memory[cpu->registers.PC + *operand1.bytes],
-         &cpu->registers.A);
-    return;
+  case 0xD2: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = !(R_F & FLAG_C))) {
+      R_PC = n16;
+    }
+    break;
   }
-
-  if (operand1.type == R_A && operand2.type == n16) {
-    assert(operand1.bytes != NULL);
-    load(&cpu->registers.A,
-         &cpu->bus.memory[cpu->registers.PC + *operand1.bytes]);
-    return;
+  case 0xDA: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = R_F & FLAG_C)) {
+      R_PC = n16;
+    }
+    break;
   }
-
-  assert(operand1.type == R_A && operand2.type == r16);
-  load(&cpu->registers.A, get_reg(cpu, operand1.type));
-  // }
-}
-
-void ldh(struct Instruction *instruction, struct CPU *cpu) {
-  assert(instruction->operand_count == 2);
-  struct Operand operand1 = instruction->operands[0];
-  struct Operand operand2 = instruction->operands[1];
-
-  if (operand1.type == n16 && operand2.type == R_A) {
-    load(&cpu->bus.memory[8 * 0xFF00 + (8 * cpu->bus.memory[cpu->registers.PC +
-                                                            *operand1.bytes])],
-         &cpu->registers.A);
-    return;
+  case 0x18:
+    jump_relative(cpu, fetch8(cpu));
+    break;
+  case 0x20: {
+    const uint8_t e8 = fetch8(cpu);
+    if ((taken = !(R_F & FLAG_Z))) {
+      jump_relative(cpu, e8);
+    }
+    break;
   }
-  if (operand1.type == R_C && operand2.type == R_A) {
-    load(&cpu->bus.memory[8 * 0xFF00 +
-                          (8 * cpu->bus.memory[cpu->registers.BC.half[1]])],
-         &cpu->registers.A);
-    return;
+  case 0x28: {
+    const uint8_t e8 = fetch8(cpu);
+    if ((taken = R_F & FLAG_Z)) {
+      jump_relative(cpu, e8);
+    }
+    break;
   }
-  if (operand1.type == R_C && operand2.type == n16) {
-    load(&cpu->registers.A,
-         &cpu->bus.memory[8 * 0xFF00 + (8 * cpu->bus.memory[cpu->registers.PC +
-                                                            *operand2.bytes])]);
-    return;
+  case 0x30: {
+    const uint8_t e8 = fetch8(cpu);
+    if ((taken = !(R_F & FLAG_C))) {
+      jump_relative(cpu, e8);
+    }
+    break;
   }
-  if (operand1.type == R_A && operand2.type == R_C) {
-    load(&cpu->registers.A,
-         &cpu->bus.memory[8 * 0xFF00 +
-                          (8 * cpu->bus.memory[cpu->registers.BC.half[1]])]);
-    return;
+  case 0x38: {
+    const uint8_t e8 = fetch8(cpu);
+    if ((taken = R_F & FLAG_C)) {
+      jump_relative(cpu, e8);
+    }
+    break;
   }
-}
-
-void jp(struct Instruction *instruction, struct CPU *cpu) {
-  struct Operand operand1 = instruction->operands[0];
-
-  if (instruction->operand_count == 1) {
-
-    switch (operand1.type) {
-    case R_HL:
-      return jump(NONE, cpu, cpu->bus.memory[cpu->registers.PC]);
-    case n16:
-      return jump(NONE, cpu, cpu->bus.memory[cpu->registers.PC]);
-    default:
-      return;
+  case 0xCD:
+    call(cpu, fetch16(cpu));
+    break;
+  case 0xC4: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = !(R_F & FLAG_Z))) {
+      call(cpu, n16);
     }
-    return;
+    break;
   }
-
-  assert(instruction->operand_count == 2);
-  jump(operand1.type, cpu, cpu->bus.memory[cpu->registers.PC]);
-  return;
-}
-
-void jr(struct Instruction *instruction, struct CPU *cpu) {
-  struct Operand operand1 = instruction->operands[0];
-
-  if (instruction->operand_count == 1) {
-    return jump_relative(NONE, cpu, &cpu->bus.memory[cpu->registers.PC]);
+  case 0xCC: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = R_F & FLAG_Z)) {
+      call(cpu, n16);
+    }
+    break;
   }
+  case 0xD4: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = !(R_F & FLAG_C))) {
+      call(cpu, n16);
+    }
+    break;
+  }
+  case 0xDC: {
+    const uint16_t n16 = fetch16(cpu);
+    if ((taken = R_F & FLAG_C)) {
+      call(cpu, n16);
+    }
+    break;
+  }
+  case 0xC9:
+    R_PC = pop(cpu);
+    break;
+  case 0xD9:
+    R_PC = pop(cpu);
+    cpu->ime = true;
+    break;
+  case 0xC0:
+    if ((taken = !(R_F & FLAG_Z))) {
+      R_PC = pop(cpu);
+    }
+    break;
+  case 0xC8:
+    if ((taken = R_F & FLAG_Z)) {
+      R_PC = pop(cpu);
+    }
+    break;
+  case 0xD0:
+    if ((taken = !(R_F & FLAG_C))) {
+      R_PC = pop(cpu);
+    }
+    break;
+  case 0xD8:
+    if ((taken = R_F & FLAG_C)) {
+      R_PC = pop(cpu);
+    }
+    break;
+  case 0xC7:
+    call(cpu, 0x00);
+    break;
+  case 0xCF:
+    call(cpu, 0x08);
+    break;
+  case 0xD7:
+    call(cpu, 0x10);
+    break;
+  case 0xDF:
+    call(cpu, 0x18);
+    break;
+  case 0xE7:
+    call(cpu, 0x20);
+    break;
+  case 0xEF:
+    call(cpu, 0x28);
+    break;
+  case 0xF7:
+    call(cpu, 0x30);
+    break;
+  case 0xFF:
+    call(cpu, 0x38);
+    break;
+
+  /* Control */
+  case 0x00:
+    break;
+  case 0x10:
+    /* STOP is two bytes long, the second one is ignored. */
+    R_PC++;
+    break;
+  case 0x76:
+    if (!cpu->ime && interrupts_pending(cpu)) {
+      cpu->halt_bug = true;
+    } else {
+      cpu->halted = true;
+    }
+    break;
+  case 0xF3:
+    cpu->ime = false;
+    cpu->ime_pending = false;
+    break;
+  case 0xFB:
+    cpu->ime_pending = true;
+    break;
+  case 0xCB:
+    return execute_cb(cpu);
 
-  assert(instruction->operand_count == 2);
-  jump_relative(operand1.type, cpu, &cpu->bus.memory[cpu->registers.PC]);
-  return;
-}
-
-void call(struct Instruction *instruction, struct CPU *cpu) {
-  struct Operand operand1 = instruction->operands[0];
-  cpu->registers.SP += 0x2;
+  default:
+    /* Illegal opcodes lock up the CPU. */
+    R_PC--;
+    break;
+  }
 
-  cpu->bus.memory[cpu->registers.SP] = 3;
+  const struct OpcodeInfo *info = &opcode_table[op];
+  return taken ? info->cycles : info->cycles_not_taken;
 }
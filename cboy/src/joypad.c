@@ -0,0 +1,27 @@
+#include <emulation.h>
+#include <joypad.h>
+#include <stdint.h>
+
+#define SELECT_DIRECTIONS 0x10
+#define SELECT_BUTTONS 0x20
+
+void joypad_set(struct CPU *cpu, uint8_t pressed) {
+  if (pressed & ~cpu->joypad.pressed) {
+    request_interrupt(cpu, INT_JOYPAD);
+  }
+  cpu->joypad.pressed = pressed;
+}
+
+uint8_t joypad_read(struct CPU *cpu, uint8_t reg) {
+  const uint8_t select = cpu->bus.io[reg] & 0x30;
+  uint8_t lines = 0;
+
+  /* Both groups are active low and selected by a 0 bit. */
+  if (!(select & SELECT_DIRECTIONS)) {
+    lines |= cpu->joypad.pressed & 0x0F;
+  }
+  if (!(select & SELECT_BUTTONS)) {
+    lines |= cpu->joypad.pressed >> 4;
+  }
+  return 0xC0 | select | (~lines & 0x0F);
+}
@@ -0,0 +1,162 @@
+#include <cboy.h>
+#include <emulation.h>
+#include <state.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* libcboy: the core behind include/cboy.h. Only the cboy_ functions are
+ * exported, the core itself is linked in with hidden visibility. */
+
+struct Cboy {
+  struct CPU cpu;
+  uint8_t *rom_copy;    /* from cboy_load_rom */
+  struct File rom_file; /* from cboy_load_rom_file */
+  bool loaded;
+  uint8_t render_interval;
+};
+
+static int32_t cart_error(enum CartridgeError err) {
+  switch (err) {
+  case CART_OK:
+    return CBOY_OK;
+  case CART_OPEN:
+    return CBOY_ERROR_OPEN;
+  case CART_UNSUPPORTED:
+    return CBOY_ERROR_UNSUPPORTED;
+  case CART_ALLOC:
+    return CBOY_ERROR_NO_MEMORY;
+  default:
+    return CBOY_ERROR_BAD_ROM;
+  }
+}
+
+static void unload(Cboy *cboy) {
+  if (cboy->loaded) {
+    cartridge_free(&cboy->cpu.cart);
+  }
+  free(cboy->rom_copy);
+  cartridge_unmap_file(&cboy->rom_file);
+  cboy->rom_copy = NULL;
+  cboy->loaded = false;
+}
+
+static int32_t start(Cboy *cboy, uint8_t *rom, uint32_t size) {
+  struct CPU *cpu = &cboy->cpu;
+
+  /* Nothing of the previous ROM may survive a reload. */
+  memset(cpu, 0, sizeof(*cpu));
+  bus_init(&cpu->bus);
+  const enum CartridgeError err = cartridge_init(cpu, rom, size, NULL);
+  if (err != CART_OK) {
+    return cart_error(err);
+  }
+  cpu_reset(cpu);
+  ppu_set_render_interval(cpu, cboy->render_interval);
+  cboy->loaded = true;
+  return CBOY_OK;
+}
+
+uint32_t cboy_api_version(void) { return CBOY_API_VERSION; }
+
+Cboy *cboy_create(void) {
+  Cboy *cboy = calloc(1, sizeof(*cboy));
+  if (cboy != NULL) {
+    cboy->render_interval = 1;
+  }
+  return cboy;
+}
+
+void cboy_destroy(Cboy *cboy) {
+  if (cboy == NULL) {
+    return;
+  }
+  unload(cboy);
+  free(cboy);
+}
+
+int32_t cboy_load_rom(Cboy *cboy, const void *data, size_t size) {
+  unload(cboy);
+  if (size > UINT32_MAX) {
+    return CBOY_ERROR_BAD_ROM;
+  }
+  const enum CartridgeError err = cartridge_check_header(data, size);
+  if (err != CART_OK) {
+    return cart_error(err);
+  }
+
+  cboy->rom_copy = malloc(size);
+  if (cboy->rom_copy == NULL) {
+    return CBOY_ERROR_NO_MEMORY;
+  }
+  memcpy(cboy->rom_copy, data, size);
+  const int32_t result = start(cboy, cboy->rom_copy, (uint32_t)size);
+  if (result != CBOY_OK) {
+    unload(cboy);
+  }
+  return result;
+}
+
+int32_t cboy_load_rom_file(Cboy *cboy, const char *path) {
+  unload(cboy);
+  const enum CartridgeError err = cartridge_map_file(path, &cboy->rom_file);
+  if (err != CART_OK) {
+    return cart_error(err);
+  }
+  const int32_t result =
+      start(cboy, cboy->rom_file.data, cboy->rom_file.size);
+  if (result != CBOY_OK) {
+    unload(cboy);
+  }
+  return result;
+}
+
+int32_t cboy_run_frame(Cboy *cboy) {
+  if (!cboy->loaded) {
+    return CBOY_ERROR_NO_ROM;
+  }
+  run_frame(&cboy->cpu);
+  return CBOY_OK;
+}
+
+void cboy_set_input(Cboy *cboy, uint8_t buttons) {
+  joypad_set(&cboy->cpu, buttons);
+}
+
+void cboy_set_render_interval(Cboy *cboy, uint8_t interval) {
+  cboy->render_interval = interval;
+  ppu_set_render_interval(&cboy->cpu, interval);
+}
+
+const uint8_t *cboy_framebuffer(const Cboy *cboy) {
+  return &cboy->cpu.screen.framebuffer[0][0];
+}
+
+uint8_t *cboy_wram(Cboy *cboy) { return cboy->cpu.bus.wram; }
+
+size_t cboy_state_size(const Cboy *cboy) {
+  return cboy->loaded ? state_size(&cboy->cpu) : 0;
+}
+
+int32_t cboy_save_state(const Cboy *cboy, void *buffer, size_t size) {
+  if (!cboy->loaded) {
+    return CBOY_ERROR_NO_ROM;
+  }
+  return state_save(&cboy->cpu, buffer, size) == STATE_OK ? CBOY_OK
+                                                          : CBOY_ERROR_BUFFER;
+}
+
+int32_t cboy_load_state(Cboy *cboy, const void *buffer, size_t size) {
+  if (!cboy->loaded) {
+    return CBOY_ERROR_NO_ROM;
+  }
+  switch (state_load(&cboy->cpu, buffer, size)) {
+  case STATE_OK:
+    return CBOY_OK;
+  case STATE_TOO_SMALL:
+    return CBOY_ERROR_BUFFER;
+  default:
+    return CBOY_ERROR_BAD_STATE;
+  }
+}
@@ -0,0 +1,585 @@
+#include <emulation.h>
+#include <lockstep.h>
+#include <opcodes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+struct Lockstep {
+  struct LaneState lanes;
+  struct CPU *cpus[LOCKSTEP_MAX_LANES];
+  struct LaneOp ops[256]; /* unprefixed opcodes, CB ones are all scalar */
+  const struct LaneKernels *kernels;
+  uint32_t count;
+  uint32_t loaded; /* lane mask */
+  uint32_t slow;   /* lanes that must go through cpu_step */
+  struct LockstepStats stats;
+};
+
+static int8_t lane_register(uint8_t name) {
+  switch (name) {
+  case OP_A:
+    return LANE_A;
+  case OP_B:
+    return LANE_B;
+  case OP_C:
+    return LANE_C;
+  case OP_D:
+    return LANE_D;
+  case OP_E:
+    return LANE_E;
+  case OP_H:
+    return LANE_H;
+  case OP_L:
+    return LANE_L;
+  default:
+    return -1;
+  }
+}
+
+static int8_t lane_pair(uint8_t name) {
+  switch (name) {
+  case OP_BC:
+    return LANE_B;
+  case OP_DE:
+    return LANE_D;
+  case OP_HL:
+    return LANE_H;
+  case OP_SP:
+    return LANE_SP;
+  default:
+    return -1;
+  }
+}
+
+/* Picks out the instructions that only touch registers and PC. Anything
+ * with a memory operand, SP+e8 or HL+/- stays scalar. */
+static struct LaneOp classify(const struct OpcodeInfo *info) {
+  struct LaneOp op = {LANE_SCALAR,  0,           0,
+                      OP_NONE,      info->bytes, info->cycles,
+                      info->cycles_not_taken};
+  const uint8_t count = info->operand_count;
+  const uint8_t first = count > 0 ? info->operands[0].name : OP_NONE;
+  const uint8_t last = count > 0 ? info->operands[count - 1].name : OP_NONE;
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (info->operands[i].flags != 0) {
+      return op;
+    }
+  }
+
+  switch (info->mnemonic) {
+  case MN_NOP:
+    op.kind = LANE_NOP;
+    break;
+  case MN_LD:
+    if (count == 2 && lane_register(first) >= 0 &&
+        (lane_register(last) >= 0 || last == OP_N8)) {
+      op.kind = LANE_LD8;
+      op.dst = lane_register(first);
+      op.src = last == OP_N8 ? LANE_IMM : lane_register(last);
+    } else if (count == 2 && lane_pair(first) >= 0 && last == OP_N16) {
+      op.kind = LANE_LD16;
+      op.dst = lane_pair(first);
+    }
+    break;
+  case MN_INC:
+  case MN_DEC:
+    if (count == 1 && lane_register(first) >= 0) {
+      op.kind = info->mnemonic == MN_INC ? LANE_INC8 : LANE_DEC8;
+      op.dst = lane_register(first);
+    } else if (count == 1 && lane_pair(first) >= 0) {
+      op.kind = info->mnemonic == MN_INC ? LANE_INC16 : LANE_DEC16;
+      op.dst = lane_pair(first);
+    }
+    break;
+  case MN_ADD:
+  case MN_ADC:
+  case MN_SUB:
+  case MN_SBC:
+  case MN_AND:
+  case MN_XOR:
+  case MN_OR:
+  case MN_CP:
+    /* Same order in both enums. ADD HL,rr and ADD SP,e8 fall out here. */
+    if (count == 2 && first == OP_A &&
+        (lane_register(last) >= 0 || last == OP_N8)) {
+      op.kind = LANE_ADD + (info->mnemonic - MN_ADD);
+      op.dst = LANE_A;
+      op.src = last == OP_N8 ? LANE_IMM : lane_register(last);
+    }
+    break;
+  case MN_CPL:
+    op.kind = LANE_CPL;
+    break;
+  case MN_SCF:
+    op.kind = LANE_SCF;
+    break;
+  case MN_CCF:
+    op.kind = LANE_CCF;
+    break;
+  case MN_RLCA:
+    op.kind = LANE_RLCA;
+    break;
+  case MN_RRCA:
+    op.kind = LANE_RRCA;
+    break;
+  case MN_RLA:
+    op.kind = LANE_RLA;
+    break;
+  case MN_RRA:
+    op.kind = LANE_RRA;
+    break;
+  case MN_JP:
+  case MN_JR:
+    /* JP HL reads a register the kernels do not treat as an address. */
+    if (last == OP_A16 || last == OP_E8) {
+      op.kind = info->mnemonic == MN_JP ? LANE_JP : LANE_JR;
+      op.cond = count == 2 ? first : OP_NONE;
+    }
+    break;
+  default:
+    break;
+  }
+  return op;
+}
+
+static bool lane_taken(uint8_t f, uint8_t cond) {
+  switch (cond) {
+  case OP_COND_NZ:
+    return !(f & FLAG_Z);
+  case OP_COND_Z:
+    return f & FLAG_Z;
+  case OP_COND_NC:
+    return !(f & FLAG_C);
+  case OP_COND_C:
+    return f & FLAG_C;
+  default:
+    return true;
+  }
+}
+
+static uint16_t get16(const struct LaneState *s, uint8_t pair, uint32_t i) {
+  if (pair == LANE_SP) {
+    return s->sp[i];
+  }
+  return s->r[pair][i] << 8 | s->r[pair + 1][i];
+}
+
+static void set16(struct LaneState *s, uint8_t pair, uint32_t i,
+                  uint16_t val) {
+  if (pair == LANE_SP) {
+    s->sp[i] = val;
+  } else {
+    s->r[pair][i] = val >> 8;
+    s->r[pair + 1][i] = val & 0xFF;
+  }
+}
+
+static uint32_t match_pc(const struct LaneState *s, uint32_t mask,
+                         uint16_t pc) {
+  uint32_t match = 0;
+  for (; mask != 0; mask &= mask - 1) {
+    const uint32_t i = __builtin_ctz(mask);
+    if (s->pc[i] == pc) {
+      match |= 1u << i;
+    }
+  }
+  return match;
+}
+
+/* One lane at a time, the same arithmetic as instruction.c. */
+static uint32_t execute(struct LaneState *s, uint32_t mask,
+                        const struct LaneOp *op, uint16_t imm) {
+  uint32_t due = 0;
+
+  for (; mask != 0; mask &= mask - 1) {
+    const uint32_t i = __builtin_ctz(mask);
+    uint8_t *a = &s->r[LANE_A][i];
+    uint8_t *f = &s->r[LANE_F][i];
+    const uint8_t val = op->src == LANE_IMM ? (uint8_t)imm : s->r[op->src][i];
+    const uint8_t carry = (*f & FLAG_C) ? 1 : 0;
+    bool taken = true;
+
+    s->pc[i] += op->bytes;
+    switch (op->kind) {
+    case LANE_LD8:
+      s->r[op->dst][i] = val;
+      break;
+    case LANE_LD16:
+      set16(s, op->dst, i, imm);
+      break;
+    case LANE_INC8: {
+      const uint8_t res = s->r[op->dst][i] + 1;
+      *f = (*f & FLAG_C) | (res == 0 ? FLAG_Z : 0) |
+           ((res & 0x0F) == 0 ? FLAG_H : 0);
+      s->r[op->dst][i] = res;
+      break;
+    }
+    case LANE_DEC8: {
+      const uint8_t res = s->r[op->dst][i] - 1;
+      *f = (*f & FLAG_C) | FLAG_N | (res == 0 ? FLAG_Z : 0) |
+           ((res & 0x0F) == 0x0F ? FLAG_H : 0);
+      s->r[op->dst][i] = res;
+      break;
+    }
+    case LANE_INC16:
+      set16(s, op->dst, i, get16(s, op->dst, i) + 1);
+      break;
+    case LANE_DEC16:
+      set16(s, op->dst, i, get16(s, op->dst, i) - 1);
+      break;
+    case LANE_ADD:
+    case LANE_ADC: {
+      const uint8_t c = op->kind == LANE_ADC ? carry : 0;
+      const uint16_t res = *a + val + c;
+      *f = ((res & 0xFF) == 0 ? FLAG_Z : 0) |
+           (((*a & 0x0F) + (val & 0x0F) + c) > 0x0F ? FLAG_H : 0) |
+           (res > 0xFF ? FLAG_C : 0);
+      *a = (uint8_t)res;
+      break;
+    }
+    case LANE_SUB:
+    case LANE_SBC:
+    case LANE_CP: {
+      const uint8_t c = op->kind == LANE_SBC ? carry : 0;
+      const int16_t res = *a - val - c;
+      *f = FLAG_N | ((res & 0xFF) == 0 ? FLAG_Z : 0) |
+           (((*a & 0x0F) - (val & 0x0F) - c) < 0 ? FLAG_H : 0) |
+           (res < 0 ? FLAG_C : 0);
+      if (op->kind != LANE_CP) {
+        *a = (uint8_t)res;
+      }
+      break;
+    }
+    case LANE_AND:
+      *a &= val;
+      *f = (*a == 0 ? FLAG_Z : 0) | FLAG_H;
+      break;
+    case LANE_XOR:
+      *a ^= val;
+      *f = *a == 0 ? FLAG_Z : 0;
+      break;
+    case LANE_OR:
+      *a |= val;
+      *f = *a == 0 ? FLAG_Z : 0;
+      break;
+    case LANE_CPL:
+      *a = ~*a;
+      *f |= FLAG_N | FLAG_H;
+      break;
+    case LANE_SCF:
+      *f = (*f & FLAG_Z) | FLAG_C;
+      break;
+    case LANE_CCF:
+      *f = (*f & FLAG_Z) | ((*f & FLAG_C) ^ FLAG_C);
+      break;
+    case LANE_RLCA:
+      *f = (*a & 0x80) ? FLAG_C : 0;
+      *a = (uint8_t)(*a << 1 | *a >> 7);
+      break;
+    case LANE_RRCA:
+      *f = (*a & 0x01) ? FLAG_C : 0;
+      *a = (uint8_t)(*a >> 1 | *a << 7);
+      break;
+    case LANE_RLA:
+      *f = (*a & 0x80) ? FLAG_C : 0;
+      *a = (uint8_t)(*a << 1 | carry);
+      break;
+    case LANE_RRA:
+      *f = (*a & 0x01) ? FLAG_C : 0;
+      *a = (uint8_t)(*a >> 1 | carry << 7);
+      break;
+    case LANE_JP:
+      if ((taken = lane_taken(*f, op->cond))) {
+        s->pc[i] = imm;
+      }
+      break;
+    case LANE_JR:
+      if ((taken = lane_taken(*f, op->cond))) {
+        s->pc[i] += (int8_t)imm;
+      }
+      break;
+    default:
+      break;
+    }
+
+    s->cycles[i] += taken ? op->cycles : op->cycles_not_taken;
+    if (s->cycles[i] >= s->next[i]) {
+      due |= 1u << i;
+    }
+  }
+  return due;
+}
+
+const struct LaneKernels lane_kernels_scalar = {
+    "scalar",
+    match_pc,
+    execute,
+};
+
+const struct LaneKernels *lane_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2")) {
+    return &lane_kernels_avx2;
+  }
+#endif
+  return &lane_kernels_scalar;
+}
+
+/* A halted lane sleeps, and a pending interrupt or EI changes what its
+ * next step does, so it goes through cpu_step. The kernels can change
+ * none of these. */
+static void update_slow(struct Lockstep *lockstep, uint32_t lane) {
+  const struct CPU *cpu = lockstep->cpus[lane];
+  const bool slow =
+      cpu->halted || cpu->halt_bug || cpu->ime_pending ||
+      (cpu->ime && interrupts_pending(lockstep->cpus[lane]) != 0);
+
+  if (slow) {
+    lockstep->slow |= 1u << lane;
+  } else {
+    lockstep->slow &= ~(1u << lane);
+  }
+}
+
+static void load_registers(struct Lockstep *lockstep, uint32_t lane) {
+  struct LaneState *s = &lockstep->lanes;
+  const struct Registers *regs = &lockstep->cpus[lane]->registers;
+
+  s->r[LANE_A][lane] = regs->A;
+  s->r[LANE_F][lane] = regs->F;
+  s->r[LANE_B][lane] = regs->BC.half[1];
+  s->r[LANE_C][lane] = regs->BC.half[0];
+  s->r[LANE_D][lane] = regs->DE.half[1];
+  s->r[LANE_E][lane] = regs->DE.half[0];
+  s->r[LANE_H][lane] = regs->HL.half[1];
+  s->r[LANE_L][lane] = regs->HL.half[0];
+  s->sp[lane] = regs->SP;
+  s->pc[lane] = regs->PC;
+}
+
+static void store_registers(struct Lockstep *lockstep, uint32_t lane) {
+  const struct LaneState *s = &lockstep->lanes;
+  struct Registers *regs = &lockstep->cpus[lane]->registers;
+
+  regs->A = s->r[LANE_A][lane];
+  regs->F = s->r[LANE_F][lane];
+  regs->BC.half[1] = s->r[LANE_B][lane];
+  regs->BC.half[0] = s->r[LANE_C][lane];
+  regs->DE.half[1] = s->r[LANE_D][lane];
+  regs->DE.half[0] = s->r[LANE_E][lane];
+  regs->HL.half[1] = s->r[LANE_H][lane];
+  regs->HL.half[0] = s->r[LANE_L][lane];
+  regs->SP = s->sp[lane];
+  regs->PC = s->pc[lane];
+}
+
+/* Picks up what the lane's CPU did outside the kernels. Returns true and
+ * finishes the frame the way run_frame does once VBlank has fired. */
+static bool lane_moved(struct Lockstep *lockstep, uint32_t lane) {
+  struct CPU *cpu = lockstep->cpus[lane];
+
+  lockstep->lanes.cycles[lane] = cpu->cycles;
+  lockstep->lanes.next[lane] = cpu->scheduler.next;
+  update_slow(lockstep, lane);
+  if ((cpu->events & EVENT_VBLANK) == 0) {
+    return false;
+  }
+
+  store_registers(lockstep, lane);
+  apu_end_frame(cpu);
+  cartridge_sync(&cpu->cart, false);
+  return true;
+}
+
+/* The lanes in mask that would fetch the same instruction bytes at pc as
+ * the leader. ROM is one mapping shared by every lane, so equal pages are
+ * enough; code copied to RAM is compared byte by byte. */
+static uint32_t same_code(const struct Lockstep *lockstep, uint32_t mask,
+                          uint32_t leader, uint16_t pc, uint8_t bytes) {
+  struct CPU *cpu = lockstep->cpus[leader];
+  const uint16_t end = pc + bytes - 1;
+  const uint8_t *first = cpu->bus.read_pages[pc >> 8];
+  const uint8_t *last = cpu->bus.read_pages[end >> 8];
+  uint32_t match = 0;
+
+  if (first == NULL || last == NULL) {
+    return 0;
+  }
+  for (; mask != 0; mask &= mask - 1) {
+    const uint32_t i = __builtin_ctz(mask);
+    struct CPU *other = lockstep->cpus[i];
+    const uint8_t *other_first = other->bus.read_pages[pc >> 8];
+    const uint8_t *other_last = other->bus.read_pages[end >> 8];
+    bool same = other_first == first && other_last == last;
+
+    if (!same && other_first != NULL && other_last != NULL) {
+      same = true;
+      for (uint16_t at = pc; at != (uint16_t)(end + 1); at++) {
+        same = same && bus_read(other, at) == bus_read(cpu, at);
+      }
+    }
+    if (same) {
+      match |= 1u << i;
+    }
+  }
+  return match;
+}
+
+struct Lockstep *lockstep_create(uint32_t lanes) {
+  if (lanes == 0 || lanes > LOCKSTEP_MAX_LANES) {
+    return NULL;
+  }
+
+  struct Lockstep *lockstep =
+      aligned_alloc(_Alignof(struct Lockstep), sizeof(struct Lockstep));
+  if (lockstep == NULL) {
+    return NULL;
+  }
+  memset(lockstep, 0, sizeof(*lockstep));
+  lockstep->count = lanes;
+  lockstep->kernels = lane_kernels();
+  for (uint16_t op = 0; op < 256; op++) {
+    lockstep->ops[op] = classify(&opcode_table[op]);
+  }
+  for (uint32_t i = 0; i < lanes; i++) {
+    lockstep->cpus[i] = calloc(1, sizeof(struct CPU));
+    if (lockstep->cpus[i] == NULL) {
+      lockstep_destroy(lockstep);
+      return NULL;
+    }
+  }
+  return lockstep;
+}
+
+void lockstep_destroy(struct Lockstep *lockstep) {
+  if (lockstep == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < lockstep->count; i++) {
+    if (lockstep->loaded & 1u << i) {
+      cartridge_free(&lockstep->cpus[i]->cart);
+    }
+    free(lockstep->cpus[i]);
+  }
+  free(lockstep);
+}
+
+enum CartridgeError lockstep_load(struct Lockstep *lockstep, uint8_t *rom,
+                                  uint32_t size) {
+  for (uint32_t i = 0; i < lockstep->count; i++) {
+    struct CPU *cpu = lockstep->cpus[i];
+
+    if (lockstep->loaded & 1u << i) {
+      cartridge_free(&cpu->cart);
+      lockstep->loaded &= ~(1u << i);
+    }
+    memset(cpu, 0, sizeof(*cpu));
+    bus_init(&cpu->bus);
+    const enum CartridgeError err = cartridge_init(cpu, rom, size, NULL);
+    if (err != CART_OK) {
+      return err;
+    }
+    cpu_reset(cpu);
+    lockstep->loaded |= 1u << i;
+  }
+  return CART_OK;
+}
+
+struct CPU *lockstep_lane(struct Lockstep *lockstep, uint32_t lane) {
+  return lockstep->cpus[lane];
+}
+
+uint32_t lockstep_lanes(const struct Lockstep *lockstep) {
+  return lockstep->count;
+}
+
+void lockstep_use_kernels(struct Lockstep *lockstep,
+                          const struct LaneKernels *kernels) {
+  lockstep->kernels = kernels;
+}
+
+/* The lowest active lane leads. Every lane at its PC steps with it, in the
+ * kernel if the instruction allows and the lane is not slow, through
+ * cpu_step otherwise. Lanes left elsewhere wait until the leader comes
+ * by or finishes its frame, which is harmless as lanes share nothing. */
+void lockstep_run_frame(struct Lockstep *lockstep) {
+  struct LaneState *s = &lockstep->lanes;
+  struct LockstepStats *stats = &lockstep->stats;
+  uint32_t active = lockstep->loaded;
+
+  for (uint32_t m = active; m != 0; m &= m - 1) {
+    const uint32_t i = __builtin_ctz(m);
+    lockstep->cpus[i]->events = 0;
+    load_registers(lockstep, i);
+    lane_moved(lockstep, i);
+  }
+
+  while (active != 0) {
+    const uint32_t leader = __builtin_ctz(active);
+    const uint16_t pc = s->pc[leader];
+    const uint32_t group = lockstep->kernels->match_pc(s, active, pc);
+    const uint8_t *page = lockstep->cpus[leader]->bus.read_pages[pc >> 8];
+    uint32_t vector = 0;
+
+    stats->steps++;
+    stats->lane_slots += __builtin_popcount(active);
+    if (group != active) {
+      stats->divergent_steps++;
+    }
+
+    if (page != NULL && lockstep->ops[page[pc & 0xFF]].kind != LANE_SCALAR) {
+      const struct LaneOp *op = &lockstep->ops[page[pc & 0xFF]];
+      struct CPU *cpu = lockstep->cpus[leader];
+      const uint16_t imm =
+          op->bytes == 3   ? bus_read(cpu, pc + 1) | bus_read(cpu, pc + 2) << 8
+          : op->bytes == 2 ? bus_read(cpu, pc + 1)
+                           : 0;
+      /* Short backward jumps may close an idle loop for cpu_step to
+       * fast-forward. */
+      if (op->kind != LANE_JR || imm < 0xF9) {
+        vector =
+            same_code(lockstep, group & ~lockstep->slow, leader, pc, op->bytes);
+      }
+      if (vector != 0) {
+        stats->vector_steps++;
+        stats->vector_instructions += __builtin_popcount(vector);
+
+        uint32_t due = lockstep->kernels->execute(s, vector, op, imm);
+        for (; due != 0; due &= due - 1) {
+          const uint32_t i = __builtin_ctz(due);
+          struct CPU *lane = lockstep->cpus[i];
+          lane->cycles = s->cycles[i];
+          scheduler_run(lane);
+          if (lane_moved(lockstep, i)) {
+            active &= ~(1u << i);
+          }
+        }
+      }
+    }
+
+    for (uint32_t m = group & ~vector; m != 0; m &= m - 1) {
+      const uint32_t i = __builtin_ctz(m);
+      struct CPU *lane = lockstep->cpus[i];
+      store_registers(lockstep, i);
+      lane->cycles = s->cycles[i];
+      cpu_step(lane);
+      load_registers(lockstep, i);
+      stats->scalar_instructions++;
+      if (lane_moved(lockstep, i)) {
+        active &= ~(1u << i);
+      }
+    }
+  }
+}
+
+struct LockstepStats lockstep_stats(const struct Lockstep *lockstep) {
+  return lockstep->stats;
+}
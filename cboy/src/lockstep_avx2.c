@@ -0,0 +1,337 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <lockstep.h>
+#include <opcodes.h>
+#include <stdint.h>
+
+/* Built with the target attribute rather than -mavx2, like the pixel
+ * kernels; lane_kernels only picks these after CPUID. One vector holds a
+ * register of all 32 lanes, lanes outside the mask are blended back. */
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+/* Bit i of mask to 0xFF in byte i. */
+__attribute__((target("avx2"))) static inline __m256i
+byte_mask(uint32_t mask) {
+  const __m256i spread = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
+      3, 3, 3, 3, 3, 3, 3, 3);
+  const __m256i bits = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+  const __m256i bytes =
+      _mm256_shuffle_epi8(_mm256_set1_epi32((int)mask), spread);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+/* The low 16 bits of mask to 0xFFFF in word i. */
+__attribute__((target("avx2"))) static inline __m256i
+word_mask(uint32_t mask) {
+  const __m256i bits = _mm256_setr_epi16(
+      1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+      (short)32768);
+  const __m256i words = _mm256_set1_epi16((short)mask);
+  return _mm256_cmpeq_epi16(_mm256_and_si256(words, bits), bits);
+}
+
+/* The low 4 bits of mask to all ones in quad word i. */
+__attribute__((target("avx2"))) static inline __m256i
+quad_mask(uint32_t mask) {
+  const __m256i bits = _mm256_setr_epi64x(1, 2, 4, 8);
+  const __m256i quads = _mm256_set1_epi64x(mask & 0x0F);
+  return _mm256_cmpeq_epi64(_mm256_and_si256(quads, bits), bits);
+}
+
+__attribute__((target("avx2"))) static inline __m256i load(const void *p) {
+  return _mm256_load_si256((const __m256i *)p);
+}
+
+__attribute__((target("avx2"))) static inline void
+store_masked(void *p, __m256i val, __m256i mask) {
+  _mm256_store_si256((__m256i *)p, _mm256_blendv_epi8(load(p), val, mask));
+}
+
+__attribute__((target("avx2"))) static inline __m256i byte(uint8_t val) {
+  return _mm256_set1_epi8((char)val);
+}
+
+__attribute__((target("avx2"))) static inline __m256i zero_flag(__m256i res) {
+  return _mm256_and_si256(_mm256_cmpeq_epi8(res, _mm256_setzero_si256()),
+                          byte(FLAG_Z));
+}
+
+/* Bit 3 and bit 7 of a carry or borrow vector to H and C. The 16-bit
+ * shifts move bits across bytes, the masks drop them again. */
+__attribute__((target("avx2"))) static inline __m256i
+half_flag(__m256i carries) {
+  return _mm256_and_si256(_mm256_slli_epi16(carries, 2), byte(FLAG_H));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+carry_flag(__m256i carries) {
+  return _mm256_and_si256(_mm256_srli_epi16(carries, 3), byte(FLAG_C));
+}
+
+__attribute__((target("avx2"))) static inline __m256i shift_right(__m256i v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 1), byte(0x7F));
+}
+
+__attribute__((target("avx2"))) static inline __m256i low_to_high(__m256i v) {
+  return _mm256_slli_epi16(_mm256_and_si256(v, byte(0x01)), 7);
+}
+
+__attribute__((target("avx2"))) static uint32_t
+match_pc(const struct LaneState *s, uint32_t mask, uint16_t pc) {
+  const __m256i want = _mm256_set1_epi16((short)pc);
+  const __m256i lo = _mm256_cmpeq_epi16(load(s->pc), want);
+  const __m256i hi = _mm256_cmpeq_epi16(load(s->pc + 16), want);
+  /* packs interleaves the 128-bit halves, the permute puts lanes back in
+   * order. */
+  const __m256i packed =
+      _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+  return (uint32_t)_mm256_movemask_epi8(packed) & mask;
+}
+
+__attribute__((target("avx2"))) static uint32_t
+execute(struct LaneState *s, uint32_t mask, const struct LaneOp *op,
+        uint16_t imm) {
+  const __m256i lanes = byte_mask(mask);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = byte(1);
+  const __m256i a = load(s->r[LANE_A]);
+  const __m256i f = load(s->r[LANE_F]);
+  const __m256i val = op->src == LANE_IMM ? byte((uint8_t)imm)
+                                          : load(s->r[op->src]);
+  const __m256i carry = _mm256_and_si256(_mm256_srli_epi16(f, 4), one);
+  /* Every lane in mask is at the same PC, so the next PC and the branch
+   * target are the same for all of them. */
+  const uint16_t next_pc = s->pc[__builtin_ctz(mask)] + op->bytes;
+  uint16_t target = next_pc;
+  uint32_t taken = mask;
+
+  switch (op->kind) {
+  case LANE_LD8:
+    store_masked(s->r[op->dst], val, lanes);
+    break;
+  case LANE_LD16:
+    if (op->dst == LANE_SP) {
+      const __m256i sp = _mm256_set1_epi16((short)imm);
+      store_masked(s->sp, sp, word_mask(mask));
+      store_masked(s->sp + 16, sp, word_mask(mask >> 16));
+    } else {
+      store_masked(s->r[op->dst], byte(imm >> 8), lanes);
+      store_masked(s->r[op->dst + 1], byte(imm & 0xFF), lanes);
+    }
+    break;
+  case LANE_INC8: {
+    const __m256i res = _mm256_add_epi8(load(s->r[op->dst]), one);
+    const __m256i h = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_and_si256(res, byte(0x0F)), zero),
+        byte(FLAG_H));
+    const __m256i flags = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(f, byte(FLAG_C)), zero_flag(res)),
+        h);
+    store_masked(s->r[op->dst], res, lanes);
+    store_masked(s->r[LANE_F], flags, lanes);
+    break;
+  }
+  case LANE_DEC8: {
+    const __m256i res = _mm256_sub_epi8(load(s->r[op->dst]), one);
+    const __m256i h = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_and_si256(res, byte(0x0F)), byte(0x0F)),
+        byte(FLAG_H));
+    const __m256i flags = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(f, byte(FLAG_C)), byte(FLAG_N)),
+        _mm256_or_si256(zero_flag(res), h));
+    store_masked(s->r[op->dst], res, lanes);
+    store_masked(s->r[LANE_F], flags, lanes);
+    break;
+  }
+  case LANE_INC16:
+  case LANE_DEC16:
+    if (op->dst == LANE_SP) {
+      const __m256i step = _mm256_set1_epi16(op->kind == LANE_INC16 ? 1 : -1);
+      store_masked(s->sp, _mm256_add_epi16(load(s->sp), step),
+                   word_mask(mask));
+      store_masked(s->sp + 16, _mm256_add_epi16(load(s->sp + 16), step),
+                   word_mask(mask >> 16));
+    } else {
+      /* The high byte takes the carry or borrow of the low one. cmpeq
+       * gives -1, so subtracting it adds one. */
+      const __m256i hi = load(s->r[op->dst]);
+      const __m256i lo = load(s->r[op->dst + 1]);
+      __m256i new_hi;
+      __m256i new_lo;
+      if (op->kind == LANE_INC16) {
+        new_lo = _mm256_add_epi8(lo, one);
+        new_hi = _mm256_sub_epi8(hi, _mm256_cmpeq_epi8(new_lo, zero));
+      } else {
+        new_lo = _mm256_sub_epi8(lo, one);
+        new_hi = _mm256_add_epi8(hi, _mm256_cmpeq_epi8(lo, zero));
+      }
+      store_masked(s->r[op->dst], new_hi, lanes);
+      store_masked(s->r[op->dst + 1], new_lo, lanes);
+    }
+    break;
+  case LANE_ADD:
+  case LANE_ADC: {
+    const __m256i c = op->kind == LANE_ADC ? carry : zero;
+    const __m256i res = _mm256_add_epi8(_mm256_add_epi8(a, val), c);
+    /* Carry out of every bit: both set, or either set and the sum bit
+     * clear. */
+    const __m256i carries =
+        _mm256_or_si256(_mm256_and_si256(a, val),
+                        _mm256_andnot_si256(res, _mm256_or_si256(a, val)));
+    const __m256i flags = _mm256_or_si256(
+        zero_flag(res),
+        _mm256_or_si256(half_flag(carries), carry_flag(carries)));
+    store_masked(s->r[LANE_A], res, lanes);
+    store_masked(s->r[LANE_F], flags, lanes);
+    break;
+  }
+  case LANE_SUB:
+  case LANE_SBC:
+  case LANE_CP: {
+    const __m256i c = op->kind == LANE_SBC ? carry : zero;
+    const __m256i res = _mm256_sub_epi8(_mm256_sub_epi8(a, val), c);
+    /* Borrow out of every bit: 0 - 1, or equal bits and a borrow in,
+     * which shows as a set difference bit. */
+    const __m256i borrows = _mm256_or_si256(
+        _mm256_andnot_si256(a, val),
+        _mm256_andnot_si256(_mm256_xor_si256(a, val), res));
+    const __m256i flags = _mm256_or_si256(
+        _mm256_or_si256(byte(FLAG_N), zero_flag(res)),
+        _mm256_or_si256(half_flag(borrows), carry_flag(borrows)));
+    if (op->kind != LANE_CP) {
+      store_masked(s->r[LANE_A], res, lanes);
+    }
+    store_masked(s->r[LANE_F], flags, lanes);
+    break;
+  }
+  case LANE_AND: {
+    const __m256i res = _mm256_and_si256(a, val);
+    store_masked(s->r[LANE_A], res, lanes);
+    store_masked(s->r[LANE_F], _mm256_or_si256(zero_flag(res), byte(FLAG_H)),
+                 lanes);
+    break;
+  }
+  case LANE_XOR:
+  case LANE_OR: {
+    const __m256i res = op->kind == LANE_XOR ? _mm256_xor_si256(a, val)
+                                             : _mm256_or_si256(a, val);
+    store_masked(s->r[LANE_A], res, lanes);
+    store_masked(s->r[LANE_F], zero_flag(res), lanes);
+    break;
+  }
+  case LANE_CPL:
+    store_masked(s->r[LANE_A], _mm256_xor_si256(a, byte(0xFF)), lanes);
+    store_masked(s->r[LANE_F], _mm256_or_si256(f, byte(FLAG_N | FLAG_H)),
+                 lanes);
+    break;
+  case LANE_SCF:
+    store_masked(s->r[LANE_F],
+                 _mm256_or_si256(_mm256_and_si256(f, byte(FLAG_Z)),
+                                 byte(FLAG_C)),
+                 lanes);
+    break;
+  case LANE_CCF:
+    store_masked(s->r[LANE_F],
+                 _mm256_or_si256(_mm256_and_si256(f, byte(FLAG_Z)),
+                                 _mm256_andnot_si256(f, byte(FLAG_C))),
+                 lanes);
+    break;
+  case LANE_RLCA:
+  case LANE_RLA: {
+    const __m256i in =
+        op->kind == LANE_RLCA
+            ? _mm256_srli_epi16(_mm256_and_si256(a, byte(0x80)), 7)
+            : carry;
+    store_masked(s->r[LANE_A], _mm256_or_si256(_mm256_add_epi8(a, a), in),
+                 lanes);
+    store_masked(s->r[LANE_F], carry_flag(_mm256_and_si256(a, byte(0x80))),
+                 lanes);
+    break;
+  }
+  case LANE_RRCA:
+  case LANE_RRA: {
+    const __m256i in = op->kind == LANE_RRCA ? low_to_high(a)
+                                             : _mm256_slli_epi16(carry, 7);
+    store_masked(s->r[LANE_A], _mm256_or_si256(shift_right(a), in), lanes);
+    store_masked(s->r[LANE_F],
+                 _mm256_slli_epi16(_mm256_and_si256(a, one), 4), lanes);
+    break;
+  }
+  case LANE_JP:
+  case LANE_JR: {
+    __m256i cond;
+    switch (op->cond) {
+    case OP_COND_NZ:
+      cond = _mm256_cmpeq_epi8(_mm256_and_si256(f, byte(FLAG_Z)), zero);
+      break;
+    case OP_COND_Z:
+      cond = _mm256_cmpeq_epi8(_mm256_and_si256(f, byte(FLAG_Z)),
+                               byte(FLAG_Z));
+      break;
+    case OP_COND_NC:
+      cond = _mm256_cmpeq_epi8(_mm256_and_si256(f, byte(FLAG_C)), zero);
+      break;
+    case OP_COND_C:
+      cond = _mm256_cmpeq_epi8(_mm256_and_si256(f, byte(FLAG_C)),
+                               byte(FLAG_C));
+      break;
+    default:
+      cond = lanes;
+      break;
+    }
+    taken = (uint32_t)_mm256_movemask_epi8(cond) & mask;
+    target = op->kind == LANE_JP ? imm : (uint16_t)(next_pc + (int8_t)imm);
+    break;
+  }
+  default:
+    break;
+  }
+
+  for (uint8_t half = 0; half < 2; half++) {
+    const uint32_t shift = half * 16;
+    __m256i pc = load(s->pc + shift);
+    pc = _mm256_blendv_epi8(pc, _mm256_set1_epi16((short)next_pc),
+                            word_mask(mask >> shift));
+    pc = _mm256_blendv_epi8(pc, _mm256_set1_epi16((short)target),
+                            word_mask(taken >> shift));
+    _mm256_store_si256((__m256i *)(s->pc + shift), pc);
+  }
+
+  /* Clocks are unsigned, flipping the sign bit lets cmpgt compare them. */
+  const __m256i bias = _mm256_set1_epi64x((long long)(1ULL << 63));
+  const __m256i cycles = _mm256_set1_epi64x(op->cycles);
+  const __m256i cycles_not_taken = _mm256_set1_epi64x(op->cycles_not_taken);
+  uint32_t due = 0;
+  for (uint8_t group = 0; group < LOCKSTEP_MAX_LANES / 4; group++) {
+    const uint32_t shift = group * 4;
+    if (((mask >> shift) & 0x0F) == 0) {
+      continue;
+    }
+    const __m256i in_mask = quad_mask(mask >> shift);
+    const __m256i add = _mm256_and_si256(
+        _mm256_blendv_epi8(cycles_not_taken, cycles, quad_mask(taken >> shift)),
+        in_mask);
+    const __m256i now = _mm256_add_epi64(load(s->cycles + shift), add);
+    _mm256_store_si256((__m256i *)(s->cycles + shift), now);
+
+    const __m256i pending =
+        _mm256_cmpgt_epi64(_mm256_xor_si256(load(s->next + shift), bias),
+                           _mm256_xor_si256(now, bias));
+    const __m256i ready = _mm256_andnot_si256(pending, in_mask);
+    due |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(ready)) << shift;
+  }
+  return due;
+}
+
+const struct LaneKernels lane_kernels_avx2 = {
+    "avx2",
+    match_pc,
+    execute,
+};
+
+#endif
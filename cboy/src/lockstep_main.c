@@ -0,0 +1,176 @@
+#include <emulation.h>
+#include <lockstep.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Runs lanes copies of one ROM on the lockstep core and reports speed and
+ * how often the lanes stayed together. --check runs the same lanes through
+ * run_frame as well and stops at the first frame where they differ. */
+
+static const char usage[] =
+    "usage: cboy-lockstep [--lanes N] [--frames N] [--kernel scalar|avx2]\n"
+    "                     [--random-input] [--check] <rom.gb>\n"
+    "  --lanes N         instances, 8 by default, at most 32\n"
+    "  --frames N        frames per lane, 600 by default\n"
+    "  --kernel          lane kernel, the widest supported by default\n"
+    "  --random-input    press different buttons on every lane\n"
+    "  --check           compare every frame against run_frame\n";
+
+/* Buttons held by lane for 16 frames at a time. */
+static uint8_t buttons(uint32_t lane, uint32_t frame) {
+  uint32_t x = (lane + 1) * 0x9E3779B9u ^ (frame / 16) * 0x85EBCA6Bu;
+  x ^= x >> 15;
+  x *= 0x2C1B3C6Du;
+  x ^= x >> 12;
+  return (uint8_t)x;
+}
+
+static bool same_state(const struct CPU *a, const struct CPU *b) {
+  return memcmp(&a->registers, &b->registers, sizeof(a->registers)) == 0 &&
+         a->cycles == b->cycles && a->ime == b->ime &&
+         a->halted == b->halted &&
+         memcmp(a->bus.wram, b->bus.wram, sizeof(a->bus.wram)) == 0 &&
+         memcmp(a->bus.hram, b->bus.hram, sizeof(a->bus.hram)) == 0 &&
+         memcmp(a->bus.io, b->bus.io, sizeof(a->bus.io)) == 0 &&
+         memcmp(a->bus.vram, b->bus.vram, sizeof(a->bus.vram)) == 0;
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(const int argc, char *argv[]) {
+  enum Errors { OK, WRONG_ARG, READ_FILE, NO_MEMORY, MISMATCH };
+  const char *rom_path = NULL;
+  const char *kernel = NULL;
+  uint32_t lanes = 8;
+  uint32_t frames = 600;
+  bool random_input = false;
+  bool check = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (strcmp(argv[i], "--lanes") == 0) {
+      lanes = (uint32_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      frames = (uint32_t)strtoul(value, NULL, 10);
+      i++;
+    } else if (strcmp(argv[i], "--kernel") == 0) {
+      kernel = value;
+      i++;
+    } else if (strcmp(argv[i], "--random-input") == 0) {
+      random_input = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else if (argv[i][0] != '-' && rom_path == NULL) {
+      rom_path = argv[i];
+    } else {
+      fputs(usage, stderr);
+      return WRONG_ARG;
+    }
+  }
+  if (rom_path == NULL || lanes == 0 || lanes > LOCKSTEP_MAX_LANES) {
+    fputs(usage, stderr);
+    return WRONG_ARG;
+  }
+
+  struct File rom = {NULL, 0};
+  uint32_t err = cartridge_map_file(rom_path, &rom);
+  if (err != CART_OK) {
+    fprintf(stderr, "Error with reading *.gb: %u\n", err);
+    return READ_FILE;
+  }
+
+  struct Lockstep *lockstep = lockstep_create(lanes);
+  struct CPU *reference = check ? calloc(lanes, sizeof(struct CPU)) : NULL;
+  if (lockstep == NULL || (check && reference == NULL)) {
+    cartridge_unmap_file(&rom);
+    return NO_MEMORY;
+  }
+  if (kernel != NULL && strcmp(kernel, "scalar") == 0) {
+    lockstep_use_kernels(lockstep, &lane_kernels_scalar);
+  } else if (kernel != NULL && strcmp(kernel, lane_kernels()->name) != 0) {
+    fprintf(stderr, "Kernel %s is not available\n", kernel);
+    return WRONG_ARG;
+  }
+
+  err = lockstep_load(lockstep, rom.data, rom.size);
+  for (uint32_t i = 0; check && err == CART_OK && i < lanes; i++) {
+    bus_init(&reference[i].bus);
+    err = cartridge_init(&reference[i], rom.data, rom.size, NULL);
+    cpu_reset(&reference[i]);
+  }
+  if (err != CART_OK) {
+    fprintf(stderr, "Unsupported cartridge: %u\n", err);
+    return READ_FILE;
+  }
+  for (uint32_t i = 0; i < lanes; i++) {
+    ppu_set_render_interval(lockstep_lane(lockstep, i), 0);
+    if (check) {
+      ppu_set_render_interval(&reference[i], 0);
+    }
+  }
+
+  enum Errors result = OK;
+  double seconds = 0;
+  for (uint32_t frame = 0; frame < frames && result == OK; frame++) {
+    for (uint32_t i = 0; random_input && i < lanes; i++) {
+      joypad_set(lockstep_lane(lockstep, i), buttons(i, frame));
+      if (check) {
+        joypad_set(&reference[i], buttons(i, frame));
+      }
+    }
+
+    const double start = now();
+    lockstep_run_frame(lockstep);
+    seconds += now() - start;
+
+    for (uint32_t i = 0; check && i < lanes; i++) {
+      run_frame(&reference[i]);
+      if (!same_state(lockstep_lane(lockstep, i), &reference[i])) {
+        fprintf(stderr, "Lane %u differs from run_frame in frame %u\n", i,
+                frame);
+        result = MISMATCH;
+        break;
+      }
+    }
+  }
+
+  const struct LockstepStats stats = lockstep_stats(lockstep);
+  const uint64_t instructions =
+      stats.vector_instructions + stats.scalar_instructions;
+  printf("%u lanes, %s kernel: %llu frames in %.3f s, %.0f fps\n", lanes,
+         kernel != NULL ? kernel : lane_kernels()->name,
+         (unsigned long long)lanes * frames, seconds,
+         lanes * frames / seconds);
+  printf("%llu steps, %.2f of %.2f active lanes per step, "
+         "%.1f%% of steps divergent\n",
+         (unsigned long long)stats.steps,
+         (double)instructions / stats.steps,
+         (double)stats.lane_slots / stats.steps,
+         100.0 * stats.divergent_steps / stats.steps);
+  printf("%.1f%% of lane instructions in the kernel, %.2f lanes per kernel "
+         "call\n",
+         100.0 * stats.vector_instructions / instructions,
+         stats.vector_steps > 0
+             ? (double)stats.vector_instructions / stats.vector_steps
+             : 0.0);
+  if (check && result == OK) {
+    printf("All lanes match run_frame\n");
+  }
+
+  for (uint32_t i = 0; check && i < lanes; i++) {
+    cartridge_free(&reference[i].cart);
+  }
+  free(reference);
+  lockstep_destroy(lockstep);
+  cartridge_unmap_file(&rom);
+  return result;
+}
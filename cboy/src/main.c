@@ -1,173 +1,452 @@
 #include <SDL3/SDL.h>
+#include <SDL3/SDL_audio.h>
 #include <SDL3/SDL_error.h>
 #include <SDL3/SDL_events.h>
+#include <SDL3/SDL_hints.h>
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_log.h>
 #include <SDL3/SDL_render.h>
 #include <SDL3/SDL_stdinc.h>
+#include <SDL3/SDL_thread.h>
 #include <SDL3/SDL_timer.h>
 #include <SDL3/SDL_video.h>
 #include <assert.h>
-#include <cJSON.h>
 #include <emulation.h>
+#include <rewind.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sync.h>
 #include <sys/types.h>
 
-#define CLOCK_SPEED 4194304
 #define SDL_MAIN_USE_CALLBACKS 1 /* use the callbacks instead of main() */
-#define WRAM 8192
-#define VRAM 8192
-#define SCREEN_X 160
-#define SCREEN_Y 160
+#define WINDOW_SCALE 4
 
-uint8_t read_file(const char *path, struct File *f) {
-  enum ErrorCodes { OK, FOPEN, FSEEK, CALLOC, FREED, FCLOSE };
+/* Audio sync keeps between AUDIO_LOW_WATER and one frame's worth more
+ * stereo frames in the ring, on top of one device period. With 256 frame
+ * periods that stays under 30 ms from APU to speaker. */
+#define AUDIO_DEVICE_FRAMES "256"
+#define AUDIO_LOW_WATER 512
+#define AUDIO_TARGET_FILL 384 /* average ring fill at wake up, in frames */
+#define AUDIO_RING_FRAMES 4096
+#define AUDIO_MAX_SKEW 0.005f /* furthest the playback rate is bent */
 
-  FILE *file = fopen(path, "r");
-  if (file == NULL) {
-    printf("File not found.");
-    return FOPEN;
+#define REWIND_FRAMES 3600 /* a minute of history at most */
+
+enum SyncMode { SYNC_AUDIO, SYNC_TIMER };
+
+/* game.gb -> game.sav, next to the ROM. */
+void save_path(const char *rom, char *out, size_t size) {
+  snprintf(out, size, "%s", rom);
+  char *dot = strrchr(out, '.');
+  if (dot == NULL || strchr(dot, '/') != NULL) {
+    dot = out + strlen(out);
   }
-  uint32_t err = fseek(file, 0, SEEK_END);
-  if (err != 0) {
-    return FSEEK;
+  snprintf(dot, size - (dot - out), ".sav");
+}
+
+/* Shades 0-3 of the framebuffer as XRGB8888. */
+static const uint32_t shades[4] = {0xFFFFFF, 0xAAAAAA, 0x555555, 0x000000};
+
+/* State shared by the SDL thread, the emulation thread and SDL's audio
+ * thread. Frames go out through the triple buffer, each one announced with
+ * frame_event, button states come in through one ring and samples go out
+ * through another. The SDL thread sleeps in SDL_WaitEvent, the emulation
+ * thread waits for the audio device to drain. */
+struct Frontend {
+  struct CPU *cpu;
+  struct Rewind *rewind; /* NULL when turned off */
+  atomic_bool quit;
+  atomic_bool rewinding; /* R held */
+  struct TripleBuffer frames;
+  Uint32 frame_event; /* pushed after every triple_publish */
+  uint8_t framebuffers[3][SCREEN_HEIGHT][SCREEN_WIDTH];
+  struct SpscRing input; /* enum Button masks, one byte per change */
+  uint8_t input_data[64];
+
+  SDL_AudioStream *audio;  /* NULL when paced by the timer */
+  SDL_Semaphore *drained;  /* signalled after every device pull */
+  struct SpscRing samples; /* interleaved int16 stereo */
+  uint8_t sample_data[AUDIO_RING_FRAMES * 2 * sizeof(int16_t)];
+};
+
+/* One texture update per frame, then a single scaled copy to the window. */
+static void present(SDL_Renderer *renderer, SDL_Texture *texture,
+                    uint8_t (*framebuffer)[SCREEN_WIDTH]) {
+  void *pixels;
+  int pitch;
+
+  if (SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+    for (uint8_t y = 0; y < SCREEN_HEIGHT; y++) {
+      uint32_t *row = (uint32_t *)((uint8_t *)pixels + y * pitch);
+      for (uint8_t x = 0; x < SCREEN_WIDTH; x++) {
+        row[x] = shades[framebuffer[y][x]];
+      }
+    }
+    SDL_UnlockTexture(texture);
   }
-  uint32_t file_size = ftell(file);
-  err = fseek(file, 0, SEEK_SET);
-  if (err != 0) {
-    return FSEEK;
+
+  SDL_RenderClear(renderer);
+  SDL_RenderTexture(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
+
+static uint8_t button_for(SDL_Scancode key) {
+  switch (key) {
+  case SDL_SCANCODE_RIGHT:
+    return BUTTON_RIGHT;
+  case SDL_SCANCODE_LEFT:
+    return BUTTON_LEFT;
+  case SDL_SCANCODE_UP:
+    return BUTTON_UP;
+  case SDL_SCANCODE_DOWN:
+    return BUTTON_DOWN;
+  case SDL_SCANCODE_X:
+    return BUTTON_A;
+  case SDL_SCANCODE_Z:
+    return BUTTON_B;
+  case SDL_SCANCODE_BACKSPACE:
+  case SDL_SCANCODE_RSHIFT:
+    return BUTTON_SELECT;
+  case SDL_SCANCODE_RETURN:
+    return BUTTON_START;
+  default:
+    return 0;
   }
-  void *data = calloc(1, file_size);
-  if (data == NULL) {
-    return CALLOC;
+}
+
+/* SDL audio thread: hands the device what it asks for, as far as the ring
+ * has it. A short ring leaves the stream to pad with silence. */
+static void SDLCALL feed_audio(void *data, SDL_AudioStream *stream,
+                               int additional, int total) {
+  struct Frontend *fe = data;
+  int16_t chunk[512 * 2];
+  uint32_t wanted = ((uint32_t)additional + 3) & ~3u;
+  (void)total;
+
+  while (wanted > 0) {
+    const uint32_t size = spsc_read(
+        &fe->samples, chunk, wanted < sizeof(chunk) ? wanted : sizeof(chunk));
+    if (size == 0) {
+      break;
+    }
+    SDL_PutAudioStreamData(stream, chunk, (int)size);
+    wanted -= size;
   }
 
-  uint32_t size = fread(data, 1, file_size, file);
-  if (size == 0) {
-    return FREED;
+  SDL_SignalSemaphore(fe->drained);
+}
+
+/* Moves the frame's samples into the ring, then sleeps until the device has
+ * played it down to AUDIO_LOW_WATER, which is what paces emulation. fill is
+ * a running average of the ring at wake up; the playback rate is bent by at
+ * most AUDIO_MAX_SKEW to hold it at AUDIO_TARGET_FILL, so a late frame slows the
+ * device a little instead of underrunning it. */
+static void sync_audio(struct Frontend *fe, float *fill) {
+  int16_t chunk[1024 * 2];
+  uint32_t room;
+
+  while ((room = spsc_free(&fe->samples) / sizeof(chunk[0]) / 2) > 0) {
+    const uint32_t count =
+        apu_read_samples(fe->cpu, chunk, room < 1024 ? room : 1024);
+    if (count == 0) {
+      break;
+    }
+    spsc_write(&fe->samples, chunk, count * sizeof(chunk[0]) * 2);
   }
-  err = fclose(file);
-  if (err != 0) {
-    return FCLOSE;
+
+  uint32_t used;
+  while ((used = spsc_used(&fe->samples) / sizeof(chunk[0]) / 2) >
+             AUDIO_LOW_WATER &&
+         !atomic_load_explicit(&fe->quit, memory_order_relaxed)) {
+    SDL_WaitSemaphoreTimeout(fe->drained, 100);
   }
-  f->size = file_size;
-  f->data = data;
-  return OK;
+
+  *fill += ((float)used - *fill) / 16;
+  float skew =
+      (*fill - AUDIO_TARGET_FILL) / AUDIO_TARGET_FILL * AUDIO_MAX_SKEW;
+  skew = SDL_clamp(skew, -AUDIO_MAX_SKEW, AUDIO_MAX_SKEW);
+  SDL_SetAudioStreamFrequencyRatio(fe->audio, 1 + skew);
 }
 
-int run_sdl(void) {
+/* Emulation thread: runs frames at the Game Boy's 59.7 Hz and publishes
+ * every drawn one, whatever the SDL thread is doing. With an audio device
+ * the device's clock sets the pace, otherwise the thread sleeps to a
+ * deadline. */
+static int emulate(void *data) {
+  struct Frontend *fe = data;
+  struct CPU *cpu = fe->cpu;
+  const uint64_t frame_ns =
+      (uint64_t)CYCLES_PER_FRAME * SDL_NS_PER_SECOND / CLOCK_SPEED;
+  uint64_t deadline = SDL_GetTicksNS();
+  float fill = AUDIO_TARGET_FILL;
+
+  while (!atomic_load_explicit(&fe->quit, memory_order_relaxed)) {
+    uint8_t buttons[sizeof(fe->input_data)];
+    const uint32_t count = spsc_read(&fe->input, buttons, sizeof(buttons));
+    for (uint32_t i = 0; i < count; i++) {
+      joypad_set(cpu, buttons[i]);
+    }
+
+    /* Stepping back brings its frame's picture along but no sound, so it
+     * is paced by the timer. */
+    const bool back =
+        fe->rewind != NULL &&
+        atomic_load_explicit(&fe->rewinding, memory_order_relaxed) &&
+        rewind_step(fe->rewind, cpu);
+    if (!back) {
+      run_frame(cpu);
+      if (fe->rewind != NULL) {
+        rewind_push(fe->rewind, cpu);
+      }
+    }
+    if (back || cpu->screen.rendering) {
+      memcpy(fe->framebuffers[fe->frames.back], cpu->screen.framebuffer,
+             sizeof(cpu->screen.framebuffer));
+      triple_publish(&fe->frames);
+      SDL_Event event = {.type = fe->frame_event};
+      SDL_PushEvent(&event);
+    }
+
+    if (fe->audio != NULL && !back) {
+      sync_audio(fe, &fill);
+      continue;
+    }
+
+    deadline += frame_ns;
+    const uint64_t now = SDL_GetTicksNS();
+    if (now < deadline) {
+      SDL_DelayNS(deadline - now);
+    } else {
+      deadline = now;
+    }
+  }
+
+  return 0;
+}
+
+/* NULL if there is no audio device, the caller then paces by the timer. */
+static SDL_AudioStream *open_audio(struct Frontend *fe) {
+  const SDL_AudioSpec spec = {SDL_AUDIO_S16, 2, APU_SAMPLE_RATE};
+
+  SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, AUDIO_DEVICE_FRAMES);
+  if (!SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+    SDL_Log("SDL_INIT_AUDIO: %s", SDL_GetError());
+    return NULL;
+  }
+
+  fe->drained = SDL_CreateSemaphore(0);
+  if (fe->drained == NULL) {
+    SDL_Log("SDL_CreateSemaphore: %s", SDL_GetError());
+    return NULL;
+  }
+
+  SDL_AudioStream *stream = SDL_OpenAudioDeviceStream(
+      SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, feed_audio, fe);
+  if (stream == NULL) {
+    SDL_Log("SDL_OpenAudioDeviceStream: %s", SDL_GetError());
+    SDL_DestroySemaphore(fe->drained);
+    fe->drained = NULL;
+  }
+  return stream;
+}
+
+int run_sdl(struct CPU *cpu, struct Rewind *history, enum SyncMode sync) {
   SDL_Window *window = NULL;
-  SDL_Renderer *renerer;
+  SDL_Renderer *renderer;
+  SDL_Texture *texture;
 
-  int res = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
-  if (res < 0) {
+  if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
     SDL_Log("SLD_INIT error: %s", SDL_GetError());
     return -1;
   }
 
-  window = SDL_CreateWindow("cboy", 592, 390, 0);
+  window = SDL_CreateWindow("cboy", SCREEN_WIDTH * WINDOW_SCALE,
+                            SCREEN_HEIGHT * WINDOW_SCALE, 0);
   if (window == NULL) {
     SDL_Log("SDL_CreateWindow: %s", SDL_GetError());
     return -2;
   }
 
-  renerer = SDL_CreateRenderer(window, NULL);
-  if (renerer == NULL) {
+  renderer = SDL_CreateRenderer(window, NULL);
+  if (renderer == NULL) {
     SDL_Log("SDL_CreateRenderer: %s", SDL_GetError());
     return -3;
   }
+  SDL_SetRenderLogicalPresentation(renderer, SCREEN_WIDTH, SCREEN_HEIGHT,
+                                   SDL_LOGICAL_PRESENTATION_LETTERBOX);
+  /* A vsync stall only holds up this thread. */
+  SDL_SetRenderVSync(renderer, 1);
+
+  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888,
+                              SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH,
+                              SCREEN_HEIGHT);
+  if (texture == NULL) {
+    SDL_Log("SDL_CreateTexture: %s", SDL_GetError());
+    return -4;
+  }
+  SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+  static struct Frontend fe;
+  fe.cpu = cpu;
+  fe.rewind = history;
+  atomic_init(&fe.quit, false);
+  atomic_init(&fe.rewinding, false);
+  triple_init(&fe.frames);
+  spsc_init(&fe.input, fe.input_data, sizeof(fe.input_data));
+  spsc_init(&fe.samples, fe.sample_data, sizeof(fe.sample_data));
+
+  fe.frame_event = SDL_RegisterEvents(1);
+  if (fe.frame_event == 0) {
+    SDL_Log("SDL_RegisterEvents: %s", SDL_GetError());
+    return -5;
+  }
+
+  fe.audio = sync == SYNC_AUDIO ? open_audio(&fe) : NULL;
+  if (sync == SYNC_AUDIO && fe.audio == NULL) {
+    SDL_Log("no audio, syncing to the timer");
+  }
+
+  SDL_Thread *thread = SDL_CreateThread(emulate, "emulation", &fe);
+  if (thread == NULL) {
+    SDL_Log("SDL_CreateThread: %s", SDL_GetError());
+    return -6;
+  }
+  if (fe.audio != NULL) {
+    SDL_ResumeAudioStreamDevice(fe.audio);
+  }
 
   SDL_Log("SDL3 init");
 
-  SDL_Event event;
+  uint8_t buttons = 0;
   bool quit = 0;
   while (!quit) {
-    while (SDL_PollEvent(&event)) {
+    SDL_Event event;
+    /* Sleep until there is input or a frame_event. */
+    bool pending = SDL_WaitEvent(&event);
+    while (pending) {
       switch (event.type) {
       case SDL_EVENT_QUIT:
         SDL_Log("SDL3 event quit");
         quit = true;
         break;
+      case SDL_EVENT_KEY_DOWN:
+      case SDL_EVENT_KEY_UP: {
+        if (event.key.scancode == SDL_SCANCODE_R) {
+          atomic_store_explicit(&fe.rewinding, event.key.down,
+                                memory_order_relaxed);
+          break;
+        }
+        const uint8_t button = button_for(event.key.scancode);
+        const uint8_t next =
+            event.key.down ? buttons | button : buttons & ~button;
+        if (next != buttons && spsc_write(&fe.input, &next, 1)) {
+          buttons = next;
+        }
+        break;
+      }
       default:
         break;
       }
+      pending = SDL_PollEvent(&event);
+    }
 
-      SDL_Delay(1);
-      /*cpu.cycleCount += 1;*/
-
-      /*SDL_SetRenderDrawColor(renerer, 0, 0, 0, 0xFF);*/
-      /*SDL_RenderClear(renerer);*/
-      /**/
-      /*SDL_RenderPresent(renerer);*/
+    if (triple_acquire(&fe.frames)) {
+      present(renderer, texture, fe.framebuffers[fe.frames.front]);
     }
   }
 
+  atomic_store(&fe.quit, true);
+  if (fe.drained != NULL) {
+    SDL_SignalSemaphore(fe.drained);
+  }
+  SDL_WaitThread(thread, NULL);
+  SDL_DestroyAudioStream(fe.audio);
+  SDL_DestroySemaphore(fe.drained);
+
   SDL_Log("SDL3 shutdown");
 
+  SDL_DestroyTexture(texture);
+  SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
-  SDL_DestroyRenderer(renerer);
   SDL_Quit();
 
   return 0;
 }
 
 int main(const int argc, char *argv[]) {
-  enum Erros { OK, WRONG_ARG, PARSE_JSON, READ_FILE };
-  if (argc != 2) {
+  enum Erros { OK, WRONG_ARG, READ_FILE, SDL };
+  /* cboy <rom.gb> [--render-every N] [--sync audio|timer] [--rewind-mb N]
+   * --render-every 0 keeps timing but draws nothing, --rewind-mb 0 turns
+   * off rewinding (hold R), which keeps up to a minute in 64 MiB. */
+  uint8_t render_every = 1;
+  size_t rewind_mb = 64;
+  enum SyncMode sync = SYNC_AUDIO;
+  bool args_ok = argc >= 2 && argc % 2 == 0;
+  for (int i = 2; args_ok && i < argc; i += 2) {
+    if (strcmp(argv[i], "--render-every") == 0) {
+      render_every = (uint8_t)strtoul(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "--sync") == 0 &&
+               strcmp(argv[i + 1], "audio") == 0) {
+      sync = SYNC_AUDIO;
+    } else if (strcmp(argv[i], "--sync") == 0 &&
+               strcmp(argv[i + 1], "timer") == 0) {
+      sync = SYNC_TIMER;
+    } else if (strcmp(argv[i], "--rewind-mb") == 0) {
+      rewind_mb = strtoul(argv[i + 1], NULL, 10);
+    } else {
+      args_ok = false;
+    }
+  }
+  if (!args_ok) {
     printf("Worng Argument\n");
     return 1;
   }
 
-  struct CPU cpu = {{0, 0, {0}, {0}, {0}, 0, 0},
-                    {malloc((uint32_t)(0xFFFF * 8))}};
+  struct CPU cpu = {0};
   SDL_Log("%s \n", argv[1]);
 
+  /* The ROM is mapped read only and the bus pages point straight into it,
+   * the header is validated before anything is allocated. */
   struct File rom = {NULL, 0};
-  uint32_t err = read_file(argv[1], &rom);
-  if (err != 0) {
-    free(rom.data);
-    free(cpu.bus.memory);
-    printf("Error with reading *.gb");
+  uint32_t err = cartridge_map_file(argv[1], &rom);
+  if (err != CART_OK) {
+    printf("Error with reading *.gb: %u", err);
     return READ_FILE;
   }
 
   SDL_Log("rom size: %d", rom.size);
-  assert(rom.size <= (0x3FFF) * 8);
-  memcpy(cpu.bus.memory, rom.data, rom.size);
-  free(rom.data);
-
-  struct File opcode = {NULL, 0};
-  err = read_file("opcodes.json", &opcode);
-  if (err != 0) {
-    printf("Error with opcodes");
-    free(opcode.data);
-    free(cpu.bus.memory);
-    return READ_FILE;
-  }
 
-  SDL_Log("Opcode size %u", opcode.size);
+  char sav[4096];
+  save_path(argv[1], sav, sizeof(sav));
 
-  cJSON *json = cJSON_ParseWithLength((char *)opcode.data, opcode.size);
-  if (json == NULL) {
-    printf("Error with json");
-    free(opcode.data);
-    free(cpu.bus.memory);
-    return PARSE_JSON;
+  bus_init(&cpu.bus);
+  err = cartridge_init(&cpu, rom.data, rom.size, sav);
+  if (err != CART_OK) {
+    cartridge_unmap_file(&rom);
+    printf("Unsupported cartridge: %u", err);
+    return READ_FILE;
   }
-  SDL_Log("JSON loaded");
+  cpu_reset(&cpu);
+  ppu_set_render_interval(&cpu, render_every);
 
-  uint32_t t = 0;
-  while (t < 10) {
-    cpu_step(&cpu, json);
-    t++;
+  struct Rewind *history = NULL;
+  if (rewind_mb > 0) {
+    history = rewind_create(&cpu, rewind_mb << 20, REWIND_FRAMES);
+    if (history == NULL) {
+      SDL_Log("rewind off: %zu MiB is too little or not available",
+              rewind_mb);
+    }
   }
 
-  free(opcode.data);
-  free(cpu.bus.memory);
+  const int res = run_sdl(&cpu, history, sync);
+
+  rewind_destroy(history);
+  cartridge_free(&cpu.cart);
+  cartridge_unmap_file(&rom);
 
-  return OK;
+  return res == 0 ? OK : SDL;
 }
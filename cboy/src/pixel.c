@@ -0,0 +1,46 @@
+#include <pixel.h>
+#include <ppu.h>
+#include <stdint.h>
+
+static void decode_tile(const uint8_t *data, uint8_t out[8][8]) {
+  for (uint8_t y = 0; y < 8; y++) {
+    const uint8_t lo = data[y * 2];
+    const uint8_t hi = data[y * 2 + 1];
+    for (uint8_t x = 0; x < 8; x++) {
+      const uint8_t bit = 7 - x;
+      out[y][x] = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
+    }
+  }
+}
+
+static void compose_line(const uint8_t *bg, const uint8_t *obj, uint8_t bgp,
+                         uint8_t obp0, uint8_t obp1, uint8_t *out) {
+  for (uint8_t x = 0; x < SCREEN_WIDTH; x++) {
+    const uint8_t color = obj[x] & OBJ_COLOR;
+    if (color != 0 && !((obj[x] & OBJ_BEHIND) && bg[x] != 0)) {
+      const uint8_t palette = obj[x] & OBJ_PALETTE ? obp1 : obp0;
+      out[x] = (palette >> (color * 2)) & 3;
+    } else {
+      out[x] = (bgp >> (bg[x] * 2)) & 3;
+    }
+  }
+}
+
+const struct PixelKernels pixel_kernels_scalar = {
+    "scalar",
+    decode_tile,
+    compose_line,
+};
+
+const struct PixelKernels *pixel_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  /* Both builtins read CPUID. */
+  if (__builtin_cpu_supports("avx2")) {
+    return &pixel_kernels_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return &pixel_kernels_sse2;
+  }
+#endif
+  return &pixel_kernels_scalar;
+}
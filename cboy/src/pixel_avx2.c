@@ -0,0 +1,83 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <pixel.h>
+#include <ppu.h>
+#include <stdint.h>
+
+/* Built with the target attribute rather than -mavx2, so nothing else in
+ * the binary assumes AVX2; pixel_kernels only picks these after CPUID. */
+
+__attribute__((target("avx2"))) static void
+decode_tile(const uint8_t *data, uint8_t out[8][8]) {
+  /* The whole tile in both lanes, so pshufb can spread any row. Lane 0
+   * holds rows y and y + 1, lane 1 rows y + 2 and y + 3. */
+  const __m256i tile =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)data));
+  const __m256i bits = _mm256_setr_epi8(
+      (char)128, 64, 32, 16, 8, 4, 2, 1, (char)128, 64, 32, 16, 8, 4, 2, 1,
+      (char)128, 64, 32, 16, 8, 4, 2, 1, (char)128, 64, 32, 16, 8, 4, 2, 1);
+  const __m256i rows = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+      6, 6, 6, 6, 6, 6, 6, 6);
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi8(2);
+
+  for (uint8_t y = 0; y < 8; y += 4) {
+    const __m256i lo_index = _mm256_add_epi8(rows, _mm256_set1_epi8(y * 2));
+    const __m256i hi_index = _mm256_add_epi8(lo_index, one);
+    const __m256i lo = _mm256_shuffle_epi8(tile, lo_index);
+    const __m256i hi = _mm256_shuffle_epi8(tile, hi_index);
+    const __m256i lo_set =
+        _mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits);
+    const __m256i hi_set =
+        _mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits);
+    const __m256i color = _mm256_or_si256(_mm256_and_si256(lo_set, one),
+                                          _mm256_and_si256(hi_set, two));
+    _mm256_storeu_si256((__m256i *)out[y], color);
+  }
+}
+
+/* Per lane pshufb table: entries 0-3 and 4-7 are the shades of lo and hi. */
+__attribute__((target("avx2"))) static inline __m256i
+shade_table(uint8_t lo, uint8_t hi) {
+  const __m128i table = _mm_setr_epi8(
+      lo & 3, (lo >> 2) & 3, (lo >> 4) & 3, lo >> 6, hi & 3, (hi >> 2) & 3,
+      (hi >> 4) & 3, hi >> 6, 0, 0, 0, 0, 0, 0, 0, 0);
+  return _mm256_broadcastsi128_si256(table);
+}
+
+__attribute__((target("avx2"))) static void
+compose_line(const uint8_t *bg, const uint8_t *obj, uint8_t bgp, uint8_t obp0,
+             uint8_t obp1, uint8_t *out) {
+  const __m256i bg_shades = shade_table(bgp, bgp);
+  const __m256i obj_shades = shade_table(obp0, obp1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i color_mask = _mm256_set1_epi8(OBJ_COLOR);
+  const __m256i index_mask = _mm256_set1_epi8(OBJ_COLOR | OBJ_PALETTE);
+  const __m256i behind_bit = _mm256_set1_epi8(OBJ_BEHIND);
+
+  for (uint8_t x = 0; x < SCREEN_WIDTH; x += 32) {
+    const __m256i b = _mm256_loadu_si256((const __m256i *)(bg + x));
+    const __m256i o = _mm256_loadu_si256((const __m256i *)(obj + x));
+
+    const __m256i transparent =
+        _mm256_cmpeq_epi8(_mm256_and_si256(o, color_mask), zero);
+    const __m256i behind = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(b, zero),
+        _mm256_cmpeq_epi8(_mm256_and_si256(o, behind_bit), behind_bit));
+    const __m256i hidden = _mm256_or_si256(transparent, behind);
+
+    const __m256i obj_shade =
+        _mm256_shuffle_epi8(obj_shades, _mm256_and_si256(o, index_mask));
+    const __m256i bg_shade = _mm256_shuffle_epi8(bg_shades, b);
+    _mm256_storeu_si256((__m256i *)(out + x),
+                        _mm256_blendv_epi8(obj_shade, bg_shade, hidden));
+  }
+}
+
+const struct PixelKernels pixel_kernels_avx2 = {
+    "avx2",
+    decode_tile,
+    compose_line,
+};
+#endif
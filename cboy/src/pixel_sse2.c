@@ -0,0 +1,85 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include <pixel.h>
+#include <ppu.h>
+#include <stdint.h>
+
+/* SSE2 is baseline on x86-64, the attribute covers 32-bit builds. */
+
+/* Bytes of b spread as b0 x8, b1 x8 for two tile rows. */
+__attribute__((target("sse2"))) static inline __m128i
+spread_rows(uint8_t b0, uint8_t b1) {
+  __m128i v = _mm_cvtsi32_si128(b0 | b1 << 8);
+  v = _mm_unpacklo_epi8(v, v);
+  v = _mm_unpacklo_epi16(v, v);
+  return _mm_unpacklo_epi32(v, v);
+}
+
+__attribute__((target("sse2"))) static void
+decode_tile(const uint8_t *data, uint8_t out[8][8]) {
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2,
+                                    4, 8, 16, 32, 64, (char)128);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi8(2);
+
+  for (uint8_t y = 0; y < 8; y += 2) {
+    const __m128i lo = spread_rows(data[y * 2], data[y * 2 + 2]);
+    const __m128i hi = spread_rows(data[y * 2 + 1], data[y * 2 + 3]);
+    const __m128i lo_set = _mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits);
+    const __m128i hi_set = _mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits);
+    const __m128i color =
+        _mm_or_si128(_mm_and_si128(lo_set, one), _mm_and_si128(hi_set, two));
+    _mm_storeu_si128((__m128i *)out[y], color);
+  }
+}
+
+/* Shades of a palette register looked up per color index, without pshufb. */
+__attribute__((target("sse2"))) static inline __m128i
+lookup(__m128i color, uint8_t palette) {
+  __m128i shade = _mm_setzero_si128();
+  for (uint8_t i = 0; i < 4; i++) {
+    const __m128i hit = _mm_cmpeq_epi8(color, _mm_set1_epi8(i));
+    shade = _mm_or_si128(
+        shade, _mm_and_si128(hit, _mm_set1_epi8((palette >> (i * 2)) & 3)));
+  }
+  return shade;
+}
+
+__attribute__((target("sse2"))) static void
+compose_line(const uint8_t *bg, const uint8_t *obj, uint8_t bgp, uint8_t obp0,
+             uint8_t obp1, uint8_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i color_mask = _mm_set1_epi8(OBJ_COLOR);
+  const __m128i palette_bit = _mm_set1_epi8(OBJ_PALETTE);
+  const __m128i behind_bit = _mm_set1_epi8(OBJ_BEHIND);
+
+  for (uint8_t x = 0; x < SCREEN_WIDTH; x += 16) {
+    const __m128i b = _mm_loadu_si128((const __m128i *)(bg + x));
+    const __m128i o = _mm_loadu_si128((const __m128i *)(obj + x));
+    const __m128i color = _mm_and_si128(o, color_mask);
+
+    const __m128i transparent = _mm_cmpeq_epi8(color, zero);
+    const __m128i behind = _mm_andnot_si128(
+        _mm_cmpeq_epi8(b, zero),
+        _mm_cmpeq_epi8(_mm_and_si128(o, behind_bit), behind_bit));
+    const __m128i hidden = _mm_or_si128(transparent, behind);
+
+    const __m128i use_obp1 =
+        _mm_cmpeq_epi8(_mm_and_si128(o, palette_bit), palette_bit);
+    const __m128i obj_shade =
+        _mm_or_si128(_mm_and_si128(use_obp1, lookup(color, obp1)),
+                     _mm_andnot_si128(use_obp1, lookup(color, obp0)));
+
+    const __m128i shade =
+        _mm_or_si128(_mm_and_si128(hidden, lookup(b, bgp)),
+                     _mm_andnot_si128(hidden, obj_shade));
+    _mm_storeu_si128((__m128i *)(out + x), shade);
+  }
+}
+
+const struct PixelKernels pixel_kernels_sse2 = {
+    "sse2",
+    decode_tile,
+    compose_line,
+};
+#endif
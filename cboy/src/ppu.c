@@ -0,0 +1,383 @@
+#include <emulation.h>
+#include <pixel.h>
+#include <ppu.h>
+#include <scheduler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OAM_SCAN_DOTS 80
+#define DRAWING_DOTS 172
+#define HBLANK_DOTS (DOTS_PER_LINE - OAM_SCAN_DOTS - DRAWING_DOTS)
+#define DMA_CYCLES (160 * 4)
+#define SPRITES_PER_LINE 10
+
+enum StatSelect {
+  STAT_HBLANK = 1 << 3,
+  STAT_VBLANK = 1 << 4,
+  STAT_OAM = 1 << 5,
+  STAT_LYC = 1 << 6,
+};
+
+enum SpriteFlags {
+  SPRITE_PALETTE = 1 << 4,
+  SPRITE_XFLIP = 1 << 5,
+  SPRITE_YFLIP = 1 << 6,
+  SPRITE_BEHIND = 1 << 7,
+};
+
+static inline bool lcd_on(const struct Ppu *ppu) {
+  return (ppu->lcdc & LCDC_ENABLE) != 0;
+}
+
+static void update_stat(struct CPU *cpu) {
+  struct Ppu *ppu = &cpu->ppu;
+  uint8_t line = 0;
+
+  if (lcd_on(ppu)) {
+    line = (ppu->stat & STAT_LYC) && ppu->ly == ppu->lyc;
+    line |= (ppu->stat & STAT_HBLANK) && ppu->mode == PPU_HBLANK;
+    line |= (ppu->stat & STAT_VBLANK) && ppu->mode == PPU_VBLANK;
+    line |= (ppu->stat & STAT_OAM) && ppu->mode == PPU_OAM_SCAN;
+  }
+
+  if (line && !ppu->stat_line) {
+    request_interrupt(cpu, INT_STAT);
+  }
+  ppu->stat_line = line;
+}
+
+static inline uint16_t tile_number(uint8_t lcdc, uint8_t index) {
+  if (lcdc & LCDC_TILE_DATA) {
+    return index;
+  }
+  return 256 + (int8_t)index;
+}
+
+/* Row of a decoded tile, decoding the whole tile first if it is dirty. */
+static inline const uint8_t *tile_row(struct CPU *cpu, uint16_t tile,
+                                      uint8_t row) {
+  struct Screen *screen = &cpu->screen;
+
+  if (screen->tile_dirty[tile]) {
+    screen->kernels->decode_tile(cpu->bus.vram + tile * 16,
+                                 screen->tiles[tile]);
+    screen->tile_dirty[tile] = 0;
+  }
+  return screen->tiles[tile][row];
+}
+
+/* Copies count decoded tiles of map row y / 8, starting at tile column
+ * first. */
+static void fetch_tiles(struct CPU *cpu, uint16_t map, uint8_t first,
+                        uint8_t y, uint8_t count, uint8_t *out) {
+  const uint8_t lcdc = cpu->ppu.lcdc;
+  const uint8_t *row = cpu->bus.vram + map + (y >> 3) * 32;
+
+  for (uint8_t t = 0; t < count; t++) {
+    const uint16_t tile = tile_number(lcdc, row[(first + t) & 31]);
+    memcpy(out + t * 8, tile_row(cpu, tile, y & 7), 8);
+  }
+}
+
+static void render_background(struct CPU *cpu, uint8_t *bg) {
+  const struct Ppu *ppu = &cpu->ppu;
+  const uint16_t map = ppu->lcdc & LCDC_BG_MAP ? 0x1C00 : 0x1800;
+  const uint8_t y = ppu->scy + ppu->ly;
+  uint8_t tiles[SCREEN_WIDTH + 8];
+
+  fetch_tiles(cpu, map, ppu->scx >> 3, y, SCREEN_WIDTH / 8 + 1, tiles);
+  memcpy(bg, tiles + (ppu->scx & 7), SCREEN_WIDTH);
+}
+
+static void render_window(struct CPU *cpu, uint8_t *bg) {
+  struct Ppu *ppu = &cpu->ppu;
+
+  if (!(ppu->lcdc & LCDC_WINDOW_ENABLE) || ppu->ly < ppu->wy ||
+      ppu->wx > SCREEN_WIDTH + 6) {
+    return;
+  }
+
+  const uint16_t map = ppu->lcdc & LCDC_WINDOW_MAP ? 0x1C00 : 0x1800;
+  const int16_t start = ppu->wx - 7;
+  uint8_t tiles[SCREEN_WIDTH + 8];
+
+  fetch_tiles(cpu, map, 0, ppu->window_line, SCREEN_WIDTH / 8 + 1, tiles);
+  for (int16_t x = start < 0 ? 0 : start; x < SCREEN_WIDTH; x++) {
+    bg[x] = tiles[x - start];
+  }
+  ppu->window_line++;
+}
+
+/* Fills obj with the highest priority opaque sprite pixel per column: the
+ * lowest X wins, then the lowest OAM index, and a winning sprite behind the
+ * background still hides the sprites under it. */
+static void render_sprites(struct CPU *cpu, uint8_t *obj) {
+  const struct Ppu *ppu = &cpu->ppu;
+  const uint8_t *oam = cpu->bus.oam;
+  const uint8_t height = ppu->lcdc & LCDC_OBJ_TALL ? 16 : 8;
+  uint8_t selected[SPRITES_PER_LINE];
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < 40 && count < SPRITES_PER_LINE; i++) {
+    const int16_t y = oam[i * 4] - 16;
+    if (ppu->ly >= y && ppu->ly < y + height) {
+      /* Insertion sort on X keeps OAM order for ties. */
+      uint8_t at = count++;
+      while (at > 0 && oam[selected[at - 1] * 4 + 1] > oam[i * 4 + 1]) {
+        selected[at] = selected[at - 1];
+        at--;
+      }
+      selected[at] = i;
+    }
+  }
+
+  /* Lowest priority first, so the winner is written last. */
+  while (count > 0) {
+    const uint8_t *sprite = oam + selected[--count] * 4;
+    const uint8_t flags = sprite[3];
+    uint8_t tile = sprite[2];
+    uint8_t row = ppu->ly - (sprite[0] - 16);
+
+    if (height == 16) {
+      tile &= 0xFE;
+    }
+    if (flags & SPRITE_YFLIP) {
+      row = height - 1 - row;
+    }
+
+    /* The bottom half of a tall sprite is the next tile. */
+    const uint8_t *pixels = tile_row(cpu, tile + (row >> 3), row & 7);
+
+    const uint8_t attributes = (flags & SPRITE_PALETTE ? OBJ_PALETTE : 0) |
+                               (flags & SPRITE_BEHIND ? OBJ_BEHIND : 0);
+    for (uint8_t px = 0; px < 8; px++) {
+      const int16_t x = sprite[1] - 8 + px;
+      const uint8_t color = pixels[flags & SPRITE_XFLIP ? 7 - px : px];
+      if (x >= 0 && x < SCREEN_WIDTH && color != 0) {
+        obj[x] = color | attributes;
+      }
+    }
+  }
+}
+
+static void render_line(struct CPU *cpu) {
+  struct Ppu *ppu = &cpu->ppu;
+  uint8_t *out = cpu->screen.framebuffer[ppu->ly];
+  uint8_t bg[SCREEN_WIDTH] = {0};
+  uint8_t obj[SCREEN_WIDTH] = {0};
+
+  /* On DMG, LCDC bit 0 blanks the window along with the background. */
+  if (ppu->lcdc & LCDC_BG_ENABLE) {
+    render_background(cpu, bg);
+    render_window(cpu, bg);
+  }
+  if (ppu->lcdc & LCDC_OBJ_ENABLE) {
+    render_sprites(cpu, obj);
+  }
+
+  cpu->screen.kernels->compose_line(bg, obj, ppu->bgp, ppu->obp0, ppu->obp1,
+                                    out);
+}
+
+static void set_mode(struct CPU *cpu, uint8_t mode) {
+  cpu->ppu.mode = mode;
+  update_stat(cpu);
+}
+
+static void start_frame(struct CPU *cpu) {
+  struct Screen *screen = &cpu->screen;
+
+  cpu->ppu.window_line = 0;
+  screen->rendering = false;
+  if (screen->render_interval != 0 &&
+      ++screen->render_count >= screen->render_interval) {
+    screen->render_count = 0;
+    screen->rendering = true;
+  }
+}
+
+static void next_line(struct CPU *cpu) {
+  struct Ppu *ppu = &cpu->ppu;
+
+  ppu->line++;
+  if (ppu->line == LINES_PER_FRAME) {
+    ppu->line = 0;
+    start_frame(cpu);
+  }
+  ppu->ly = lcd_on(ppu) ? ppu->line : 0;
+
+  if (ppu->line == SCREEN_HEIGHT) {
+    /* The frame clock keeps running with the LCD off. */
+    cpu->events |= EVENT_VBLANK;
+    if (lcd_on(ppu)) {
+      request_interrupt(cpu, INT_VBLANK);
+    }
+    set_mode(cpu, PPU_VBLANK);
+  } else if (ppu->line < SCREEN_HEIGHT) {
+    set_mode(cpu, PPU_OAM_SCAN);
+  } else {
+    update_stat(cpu);
+  }
+}
+
+void ppu_reset(struct CPU *cpu) {
+  struct Ppu *ppu = &cpu->ppu;
+  struct Screen *screen = &cpu->screen;
+
+  memset(ppu, 0, sizeof(*ppu));
+  ppu->lcdc = 0x91;
+  ppu->bgp = 0xFC;
+  ppu->mode = PPU_OAM_SCAN;
+  memset(screen, 0, sizeof(*screen));
+  screen->kernels = pixel_kernels();
+  screen->render_interval = 1;
+  screen->rendering = true;
+  ppu_invalidate_tiles(cpu);
+  schedule(cpu, SCHED_PPU, cpu->cycles + OAM_SCAN_DOTS);
+  unschedule(cpu, SCHED_DMA);
+}
+
+void ppu_set_render_interval(struct CPU *cpu, uint8_t interval) {
+  cpu->screen.render_interval = interval;
+  cpu->screen.render_count = interval != 0 ? interval - 1 : 0;
+}
+
+void ppu_invalidate_tiles(struct CPU *cpu) {
+  memset(cpu->screen.tile_dirty, 1, sizeof(cpu->screen.tile_dirty));
+}
+
+void ppu_write_vram(struct CPU *cpu, uint16_t address, uint8_t val) {
+  const uint16_t offset = address - 0x8000;
+
+  if (cpu->bus.vram[offset] != val) {
+    cpu->bus.vram[offset] = val;
+    cpu->screen.tile_dirty[offset >> 4] = 1;
+  }
+}
+
+void ppu_event(struct CPU *cpu, uint64_t time) {
+  struct Ppu *ppu = &cpu->ppu;
+
+  switch (ppu->mode) {
+  case PPU_OAM_SCAN:
+    if (lcd_on(ppu) && cpu->screen.rendering) {
+      render_line(cpu);
+    }
+    set_mode(cpu, PPU_DRAWING);
+    schedule(cpu, SCHED_PPU, time + DRAWING_DOTS);
+    break;
+  case PPU_DRAWING:
+    set_mode(cpu, PPU_HBLANK);
+    schedule(cpu, SCHED_PPU, time + HBLANK_DOTS);
+    break;
+  default:
+    /* End of a line, in HBlank or anywhere in VBlank. */
+    next_line(cpu);
+    schedule(cpu, SCHED_PPU,
+             time + (ppu->mode == PPU_OAM_SCAN ? OAM_SCAN_DOTS
+                                               : DOTS_PER_LINE));
+    break;
+  }
+}
+
+void ppu_dma_event(struct CPU *cpu, uint64_t time) {
+  (void)time;
+  cpu->ppu.dma = false;
+}
+
+uint8_t ppu_read(struct CPU *cpu, uint8_t reg) {
+  const struct Ppu *ppu = &cpu->ppu;
+
+  switch (reg) {
+  case 0x40:
+    return ppu->lcdc;
+  case 0x41:
+    if (!lcd_on(ppu)) {
+      return 0x80 | (ppu->stat & 0x78);
+    }
+    return 0x80 | (ppu->stat & 0x78) | (ppu->ly == ppu->lyc) << 2 | ppu->mode;
+  case 0x42:
+    return ppu->scy;
+  case 0x43:
+    return ppu->scx;
+  case 0x44:
+    return ppu->ly;
+  case 0x45:
+    return ppu->lyc;
+  case 0x47:
+    return ppu->bgp;
+  case 0x48:
+    return ppu->obp0;
+  case 0x49:
+    return ppu->obp1;
+  case 0x4A:
+    return ppu->wy;
+  case 0x4B:
+    return ppu->wx;
+  default:
+    return cpu->bus.io[reg];
+  }
+}
+
+void ppu_write(struct CPU *cpu, uint8_t reg, uint8_t val) {
+  struct Ppu *ppu = &cpu->ppu;
+
+  switch (reg) {
+  case 0x40:
+    if ((val ^ ppu->lcdc) & LCDC_ENABLE) {
+      /* Switching the LCD either way restarts the frame at line 0. */
+      ppu->line = 0;
+      ppu->ly = 0;
+      ppu->mode = PPU_OAM_SCAN;
+      start_frame(cpu);
+      schedule(cpu, SCHED_PPU, cpu->cycles + OAM_SCAN_DOTS);
+    }
+    ppu->lcdc = val;
+    update_stat(cpu);
+    break;
+  case 0x41:
+    ppu->stat = val & 0x78;
+    update_stat(cpu);
+    break;
+  case 0x42:
+    ppu->scy = val;
+    break;
+  case 0x43:
+    ppu->scx = val;
+    break;
+  case 0x45:
+    ppu->lyc = val;
+    update_stat(cpu);
+    break;
+  case 0x46:
+    /* OAM DMA. The copy is done at once, OAM just stays locked for the
+     * 160 M-cycles the transfer takes. */
+    cpu->bus.io[reg] = val;
+    ppu->dma = false;
+    for (uint8_t i = 0; i < sizeof(cpu->bus.oam); i++) {
+      cpu->bus.oam[i] = bus_read(cpu, val << 8 | i);
+    }
+    ppu->dma = true;
+    schedule(cpu, SCHED_DMA, cpu->cycles + DMA_CYCLES);
+    break;
+  case 0x47:
+    ppu->bgp = val;
+    break;
+  case 0x48:
+    ppu->obp0 = val;
+    break;
+  case 0x49:
+    ppu->obp1 = val;
+    break;
+  case 0x4A:
+    ppu->wy = val;
+    break;
+  case 0x4B:
+    ppu->wx = val;
+    break;
+  default:
+    /* LY is read only. */
+    break;
+  }
+}
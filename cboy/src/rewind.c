@@ -0,0 +1,258 @@
+#include <emulation.h>
+#include <rewind.h>
+#include <state.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A delta is a list of tokens: a 16-bit count of unchanged bytes to skip,
+ * a 16-bit count of changed bytes, then those bytes XOR their old value.
+ * A literal only ends at a run of MIN_SKIP unchanged bytes, shorter runs
+ * are cheaper to keep than to cut the literal for. */
+#define TOKEN_MAX 0xFFFF
+#define TOKEN_HEADER 4
+#define MIN_SKIP 8
+
+struct Entry {
+  size_t offset; /* in the ring */
+  size_t size;
+};
+
+struct Rewind {
+  size_t state_size;
+  size_t snapshot_size; /* the state, then the framebuffer */
+  uint8_t *newest;      /* snapshot of the newest frame, kept whole */
+  uint8_t *next;        /* snapshot being pushed */
+  uint8_t *delta;       /* encoder output, sized for the worst case */
+  bool started;         /* newest holds a frame */
+
+  uint8_t *ring;
+  size_t capacity;
+  size_t head; /* where the next delta goes */
+  size_t used;
+
+  struct Entry *entries; /* oldest first, from first on */
+  uint32_t max_frames;
+  uint32_t first;
+  uint32_t count;
+};
+
+static size_t delta_bound(size_t size) {
+  return size + TOKEN_HEADER * (size / TOKEN_MAX + 2);
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint8_t *put_token(uint8_t *out, size_t skip, size_t count) {
+  const uint16_t header[2] = {(uint16_t)skip, (uint16_t)count};
+  memcpy(out, header, sizeof(header));
+  return out + TOKEN_HEADER;
+}
+
+/* Encodes cur ^ prev, returns the size written to out. */
+static size_t encode(const uint8_t *prev, const uint8_t *cur, size_t size,
+                     uint8_t *out) {
+  uint8_t *const start = out;
+  size_t i = 0;
+
+  while (i < size) {
+    const size_t unchanged = i;
+    while (i + 8 <= size && load64(prev + i) == load64(cur + i)) {
+      i += 8;
+    }
+    while (i < size && prev[i] == cur[i]) {
+      i++;
+    }
+    if (i == size) {
+      break;
+    }
+
+    size_t skip = i - unchanged;
+    while (skip > TOKEN_MAX) {
+      out = put_token(out, TOKEN_MAX, 0);
+      skip -= TOKEN_MAX;
+    }
+
+    /* Extend the literal over short unchanged runs. */
+    size_t end = i;
+    size_t j = i;
+    while (j < size && j - i < TOKEN_MAX) {
+      if (prev[j] != cur[j]) {
+        end = ++j;
+        continue;
+      }
+      size_t run = j;
+      while (run < size && run - j < MIN_SKIP && prev[run] == cur[run]) {
+        run++;
+      }
+      if (run == size || run - j == MIN_SKIP) {
+        break;
+      }
+      j = run;
+    }
+
+    out = put_token(out, skip, end - i);
+    for (; i < end; i++) {
+      *out++ = prev[i] ^ cur[i];
+    }
+  }
+  return out - start;
+}
+
+/* XORs a delta into snapshot, which turns either side into the other. */
+static void decode(const uint8_t *in, size_t size, uint8_t *snapshot) {
+  const uint8_t *const end = in + size;
+  uint8_t *at = snapshot;
+
+  while (in < end) {
+    uint16_t header[2];
+    memcpy(header, in, sizeof(header));
+    in += TOKEN_HEADER;
+    at += header[0];
+    for (uint16_t i = 0; i < header[1]; i++) {
+      at[i] ^= in[i];
+    }
+    at += header[1];
+    in += header[1];
+  }
+}
+
+static void snapshot(const struct Rewind *rewind, const struct CPU *cpu,
+                     uint8_t *out) {
+  state_save(cpu, out, rewind->state_size);
+  memcpy(out + rewind->state_size, cpu->screen.framebuffer,
+         sizeof(cpu->screen.framebuffer));
+}
+
+static void drop_oldest(struct Rewind *rewind) {
+  rewind->used -= rewind->entries[rewind->first].size;
+  rewind->first = (rewind->first + 1) % rewind->max_frames;
+  rewind->count--;
+}
+
+/* Offset for size more bytes, dropping the oldest frames until they fit.
+ * The live bytes run from the oldest delta round to head. Deltas never
+ * wrap, one that does not fit before the end starts over at 0. */
+static size_t make_room(struct Rewind *rewind, size_t size) {
+  while (rewind->count > 0) {
+    const size_t oldest = rewind->entries[rewind->first].offset;
+    if (rewind->head >= oldest) {
+      if (rewind->head + size <= rewind->capacity) {
+        return rewind->head;
+      }
+      if (size < oldest) {
+        return 0;
+      }
+    } else if (rewind->head + size < oldest) {
+      return rewind->head;
+    }
+    drop_oldest(rewind);
+  }
+  return 0;
+}
+
+struct Rewind *rewind_create(const struct CPU *cpu, size_t bytes,
+                             uint32_t frames) {
+  const size_t state = state_size(cpu);
+  const size_t snapshot_size = state + sizeof(cpu->screen.framebuffer);
+  if (frames == 0 || bytes < delta_bound(snapshot_size)) {
+    return NULL;
+  }
+
+  struct Rewind *rewind = calloc(1, sizeof(*rewind));
+  if (rewind == NULL) {
+    return NULL;
+  }
+  rewind->state_size = state;
+  rewind->snapshot_size = snapshot_size;
+  rewind->capacity = bytes;
+  rewind->max_frames = frames;
+  rewind->newest = malloc(snapshot_size);
+  rewind->next = malloc(snapshot_size);
+  rewind->delta = malloc(delta_bound(snapshot_size));
+  rewind->ring = malloc(bytes);
+  rewind->entries = calloc(frames, sizeof(*rewind->entries));
+  if (rewind->newest == NULL || rewind->next == NULL ||
+      rewind->delta == NULL || rewind->ring == NULL ||
+      rewind->entries == NULL) {
+    rewind_destroy(rewind);
+    return NULL;
+  }
+  return rewind;
+}
+
+void rewind_destroy(struct Rewind *rewind) {
+  if (rewind == NULL) {
+    return;
+  }
+  free(rewind->newest);
+  free(rewind->next);
+  free(rewind->delta);
+  free(rewind->ring);
+  free(rewind->entries);
+  free(rewind);
+}
+
+void rewind_push(struct Rewind *rewind, const struct CPU *cpu) {
+  if (!rewind->started) {
+    snapshot(rewind, cpu, rewind->newest);
+    rewind->started = true;
+    return;
+  }
+
+  snapshot(rewind, cpu, rewind->next);
+  const size_t size = encode(rewind->newest, rewind->next,
+                             rewind->snapshot_size, rewind->delta);
+
+  if (rewind->count == rewind->max_frames) {
+    drop_oldest(rewind);
+  }
+  const size_t offset = make_room(rewind, size);
+  memcpy(rewind->ring + offset, rewind->delta, size);
+  rewind->entries[(rewind->first + rewind->count) % rewind->max_frames] =
+      (struct Entry){offset, size};
+  rewind->count++;
+  rewind->head = offset + size;
+  rewind->used += size;
+
+  uint8_t *newest = rewind->next;
+  rewind->next = rewind->newest;
+  rewind->newest = newest;
+}
+
+bool rewind_step(struct Rewind *rewind, struct CPU *cpu) {
+  if (rewind->count == 0) {
+    return false;
+  }
+
+  const uint32_t last =
+      (rewind->first + rewind->count - 1) % rewind->max_frames;
+  const struct Entry entry = rewind->entries[last];
+  decode(rewind->ring + entry.offset, entry.size, rewind->newest);
+  rewind->count--;
+  rewind->used -= entry.size;
+  rewind->head = rewind->count > 0 ? entry.offset : 0;
+
+  state_load(cpu, rewind->newest, rewind->state_size);
+  memcpy(cpu->screen.framebuffer, rewind->newest + rewind->state_size,
+         sizeof(cpu->screen.framebuffer));
+  return true;
+}
+
+void rewind_clear(struct Rewind *rewind) {
+  rewind->started = false;
+  rewind->head = 0;
+  rewind->used = 0;
+  rewind->first = 0;
+  rewind->count = 0;
+}
+
+struct RewindStats rewind_stats(const struct Rewind *rewind) {
+  return (struct RewindStats){rewind->count, rewind->used, rewind->capacity};
+}
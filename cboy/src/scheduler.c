@@ -0,0 +1,120 @@
+#include <apu.h>
+#include <emulation.h>
+#include <ppu.h>
+#include <scheduler.h>
+#include <serial.h>
+#include <stdint.h>
+#include <timer.h>
+
+static void (*const handlers[SCHED_KINDS])(struct CPU *cpu, uint64_t time) = {
+    [SCHED_PPU] = ppu_event,       [SCHED_TIMER] = timer_event,
+    [SCHED_SERIAL] = serial_event, [SCHED_DMA] = ppu_dma_event,
+    [SCHED_APU] = apu_event,
+};
+
+static inline void place(struct Scheduler *sched, uint8_t at,
+                         struct ScheduledEvent event) {
+  sched->heap[at] = event;
+  sched->slot[event.kind] = at + 1;
+}
+
+static void sift_up(struct Scheduler *sched, uint8_t at) {
+  const struct ScheduledEvent event = sched->heap[at];
+
+  while (at > 0) {
+    const uint8_t parent = (at - 1) / 2;
+    if (sched->heap[parent].time <= event.time) {
+      break;
+    }
+    place(sched, at, sched->heap[parent]);
+    at = parent;
+  }
+  place(sched, at, event);
+}
+
+static void sift_down(struct Scheduler *sched, uint8_t at) {
+  const struct ScheduledEvent event = sched->heap[at];
+
+  for (;;) {
+    uint8_t child = at * 2 + 1;
+    if (child >= sched->size) {
+      break;
+    }
+    if (child + 1 < sched->size &&
+        sched->heap[child + 1].time < sched->heap[child].time) {
+      child++;
+    }
+    if (event.time <= sched->heap[child].time) {
+      break;
+    }
+    place(sched, at, sched->heap[child]);
+    at = child;
+  }
+  place(sched, at, event);
+}
+
+static inline void update_next(struct Scheduler *sched) {
+  sched->next = sched->size > 0 ? sched->heap[0].time : SCHED_NEVER;
+}
+
+void scheduler_reset(struct CPU *cpu) {
+  struct Scheduler *sched = &cpu->scheduler;
+
+  sched->size = 0;
+  for (uint8_t i = 0; i < SCHED_KINDS; i++) {
+    sched->slot[i] = 0;
+  }
+  update_next(sched);
+}
+
+void schedule(struct CPU *cpu, enum EventKind kind, uint64_t time) {
+  struct Scheduler *sched = &cpu->scheduler;
+  const struct ScheduledEvent event = {time, kind};
+
+  if (sched->slot[kind] == 0) {
+    place(sched, sched->size++, event);
+    sift_up(sched, sched->size - 1);
+  } else {
+    const uint8_t at = sched->slot[kind] - 1;
+    const uint64_t old = sched->heap[at].time;
+    sched->heap[at] = event;
+    if (time < old) {
+      sift_up(sched, at);
+    } else {
+      sift_down(sched, at);
+    }
+  }
+  update_next(sched);
+}
+
+void unschedule(struct CPU *cpu, enum EventKind kind) {
+  struct Scheduler *sched = &cpu->scheduler;
+
+  if (sched->slot[kind] == 0) {
+    return;
+  }
+
+  const uint8_t at = sched->slot[kind] - 1;
+  sched->slot[kind] = 0;
+  if (at != --sched->size) {
+    /* The last event fills the hole and moves whichever way it must. */
+    const uint64_t old = sched->heap[at].time;
+    place(sched, at, sched->heap[sched->size]);
+    if (sched->heap[at].time < old) {
+      sift_up(sched, at);
+    } else {
+      sift_down(sched, at);
+    }
+  }
+  update_next(sched);
+}
+
+void scheduler_run(struct CPU *cpu) {
+  struct Scheduler *sched = &cpu->scheduler;
+
+  while (sched->next <= cpu->cycles) {
+    const struct ScheduledEvent event = sched->heap[0];
+    unschedule(cpu, event.kind);
+    handlers[event.kind](cpu, event.time);
+  }
+}
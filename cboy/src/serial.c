@@ -0,0 +1,47 @@
+#include <emulation.h>
+#include <scheduler.h>
+#include <serial.h>
+#include <stdint.h>
+
+#define SC_TRANSFER 0x80
+#define SC_INTERNAL_CLOCK 0x01
+#define TRANSFER_CYCLES (8 * 512) /* eight bits at 8192 Hz */
+
+uint8_t serial_read(struct CPU *cpu, uint8_t reg) {
+  if (reg == 0x01) {
+    return cpu->serial.sb;
+  }
+  return cpu->serial.sc | 0x7E;
+}
+
+void serial_write(struct CPU *cpu, uint8_t reg, uint8_t val) {
+  struct Serial *serial = &cpu->serial;
+
+  if (reg == 0x01) {
+    serial->sb = val;
+    return;
+  }
+
+  serial->sc = val & (SC_TRANSFER | SC_INTERNAL_CLOCK);
+  if ((serial->sc & (SC_TRANSFER | SC_INTERNAL_CLOCK)) !=
+      (SC_TRANSFER | SC_INTERNAL_CLOCK)) {
+    /* Stopped, or waiting on an external clock nobody provides. */
+    unschedule(cpu, SCHED_SERIAL);
+    return;
+  }
+
+  schedule(cpu, SCHED_SERIAL, cpu->cycles + TRANSFER_CYCLES);
+}
+
+void serial_event(struct CPU *cpu, uint64_t time) {
+  struct Serial *serial = &cpu->serial;
+  (void)time;
+
+  /* Nobody is connected: the byte goes out, 0xFF comes back in. */
+  if (serial->out != NULL) {
+    serial->out(serial->user, serial->sb);
+  }
+  serial->sb = 0xFF;
+  serial->sc &= ~SC_TRANSFER;
+  request_interrupt(cpu, INT_SERIAL);
+}
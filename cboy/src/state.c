@@ -0,0 +1,179 @@
+#include <blip.h>
+#include <bus.h>
+#include <cartridge.h>
+#include <emulation.h>
+#include <ppu.h>
+#include <state.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STATE_MAGIC 0x54534243 /* "CBST" little endian */
+#define HEADER_GLOBAL_CHECKSUM 0x14E
+
+/* The machine is the part of struct CPU between the bus page tables and
+ * the blip buffers, see its layout. Anything in there that is not machine
+ * state is a handful of host pointers, patched on the way in and out. */
+#define MACHINE_START offsetof(struct CPU, bus.vram)
+#define MACHINE_END offsetof(struct CPU, apu.blip)
+#define MACHINE_SIZE (MACHINE_END - MACHINE_START)
+
+struct StateHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size; /* of the whole state, differs between layouts */
+  uint32_t ram_size;
+  uint32_t rom_size;
+  uint16_t rom_checksum;
+  uint16_t padding;
+};
+
+/* The format is this layout: changing any of it needs a STATE_VERSION
+ * bump, and the numbers below updated with it. They are for LP64 hosts,
+ * the others only get the ordering checked. */
+_Static_assert(sizeof(struct StateHeader) == 24, "state header");
+_Static_assert(MACHINE_START < offsetof(struct CPU, registers) &&
+                   offsetof(struct CPU, events) < offsetof(struct CPU, ppu) &&
+                   offsetof(struct CPU, ppu) < offsetof(struct CPU, apu) &&
+                   MACHINE_END < offsetof(struct CPU, screen),
+               "struct CPU order the machine depends on");
+#if STATE_VERSION == 2 && UINTPTR_MAX == UINT64_MAX
+#define MACHINE_OFFSET(field) (offsetof(struct CPU, field) - MACHINE_START)
+_Static_assert(MACHINE_OFFSET(registers) == 16800 &&
+                   MACHINE_OFFSET(cart) == 16816 &&
+                   MACHINE_OFFSET(timer) == 16864 &&
+                   MACHINE_OFFSET(serial) == 16888 &&
+                   MACHINE_OFFSET(joypad) == 16912 &&
+                   MACHINE_OFFSET(scheduler) == 16920 &&
+                   MACHINE_OFFSET(ime) == 17016 &&
+                   MACHINE_OFFSET(cycles) == 17024 &&
+                   MACHINE_OFFSET(events) == 17040 &&
+                   MACHINE_OFFSET(ppu) == 17041 &&
+                   MACHINE_OFFSET(apu) == 17064,
+               "struct CPU layout changed, bump STATE_VERSION");
+_Static_assert(MACHINE_SIZE == 17272,
+               "struct CPU size changed, bump STATE_VERSION");
+#undef MACHINE_OFFSET
+#endif
+
+static uint16_t rom_checksum(const struct Cartridge *cart) {
+  return cart->rom[HEADER_GLOBAL_CHECKSUM] << 8 |
+         cart->rom[HEADER_GLOBAL_CHECKSUM + 1];
+}
+
+/* The host pointers in the machine, all of which belong to the instance. */
+struct Host {
+  uint8_t *rom;
+  uint8_t *ram;
+  bool ram_saved;
+  void (*serial_out)(void *user, uint8_t byte);
+  void *serial_user;
+};
+
+/* Zeroes the field at offset in a saved copy of the machine. */
+static void blank(uint8_t *machine, size_t offset, size_t size) {
+  memset(machine + offset - MACHINE_START, 0, size);
+}
+
+size_t state_size(const struct CPU *cpu) {
+  return sizeof(struct StateHeader) + MACHINE_SIZE + cpu->cart.ram_size;
+}
+
+enum StateError state_save(const struct CPU *cpu, void *buffer, size_t size) {
+  if (size < state_size(cpu)) {
+    return STATE_TOO_SMALL;
+  }
+
+  const struct StateHeader header = {
+      .magic = STATE_MAGIC,
+      .version = STATE_VERSION,
+      .size = (uint32_t)state_size(cpu),
+      .ram_size = cpu->cart.ram_size,
+      .rom_size = cpu->cart.rom_size,
+      .rom_checksum = rom_checksum(&cpu->cart),
+  };
+  uint8_t *out = buffer;
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+
+  /* Host pointers are blanked in the copy, so the same machine always
+   * gives the same bytes whichever instance it runs in. */
+  memcpy(out, (const uint8_t *)cpu + MACHINE_START, MACHINE_SIZE);
+  blank(out, offsetof(struct CPU, cart.rom), sizeof(cpu->cart.rom));
+  blank(out, offsetof(struct CPU, cart.ram), sizeof(cpu->cart.ram));
+  blank(out, offsetof(struct CPU, cart.ram_saved), sizeof(cpu->cart.ram_saved));
+  blank(out, offsetof(struct CPU, serial.out), sizeof(cpu->serial.out));
+  blank(out, offsetof(struct CPU, serial.user), sizeof(cpu->serial.user));
+
+  /* Heap entries are copied as whole structs, leaving garbage in their
+   * padding and in the slots past size. Only the live fields go out. */
+  const struct Scheduler *sched = &cpu->scheduler;
+  blank(out, offsetof(struct CPU, scheduler.heap), sizeof(sched->heap));
+  for (uint8_t i = 0; i < sched->size; i++) {
+    const struct ScheduledEvent *event = &sched->heap[i];
+    uint8_t *entry = out + offsetof(struct CPU, scheduler.heap) -
+                     MACHINE_START + i * sizeof(*event);
+    memcpy(entry + offsetof(struct ScheduledEvent, time), &event->time,
+           sizeof(event->time));
+    memcpy(entry + offsetof(struct ScheduledEvent, kind), &event->kind,
+           sizeof(event->kind));
+  }
+
+  if (cpu->cart.ram_size > 0) {
+    memcpy(out + MACHINE_SIZE, cpu->cart.ram, cpu->cart.ram_size);
+  }
+  return STATE_OK;
+}
+
+enum StateError state_load(struct CPU *cpu, const void *buffer, size_t size) {
+  const uint8_t *in = buffer;
+  struct StateHeader header;
+
+  if (size < sizeof(header)) {
+    return STATE_TOO_SMALL;
+  }
+  memcpy(&header, in, sizeof(header));
+  if (header.magic != STATE_MAGIC) {
+    return STATE_BAD_MAGIC;
+  }
+  if (header.version != STATE_VERSION) {
+    return STATE_BAD_VERSION;
+  }
+  if (header.ram_size != cpu->cart.ram_size ||
+      header.rom_size != cpu->cart.rom_size ||
+      header.rom_checksum != rom_checksum(&cpu->cart)) {
+    return STATE_OTHER_ROM;
+  }
+  /* Same version and ROM but another size: a build with another layout. */
+  if (header.size != state_size(cpu)) {
+    return STATE_BAD_VERSION;
+  }
+  if (size < state_size(cpu)) {
+    return STATE_TOO_SMALL;
+  }
+  in += sizeof(header);
+
+  const struct Host host = {cpu->cart.rom, cpu->cart.ram, cpu->cart.ram_saved,
+                            cpu->serial.out, cpu->serial.user};
+  memcpy((uint8_t *)cpu + MACHINE_START, in, MACHINE_SIZE);
+  cpu->cart.rom = host.rom;
+  cpu->cart.ram = host.ram;
+  cpu->cart.ram_saved = host.ram_saved;
+  cpu->serial.out = host.serial_out;
+  cpu->serial.user = host.serial_user;
+
+  if (cpu->cart.ram_size > 0) {
+    memcpy(cpu->cart.ram, in + MACHINE_SIZE, cpu->cart.ram_size);
+    cpu->cart.ram_dirty = cpu->cart.ram_saved;
+  }
+
+  /* Rebuild what the machine implies: page tables, decoded tiles, and a
+   * blip frame starting at the restored apu.frame_start. Pending samples
+   * belong to the abandoned timeline and are dropped. */
+  bus_map_fixed(&cpu->bus);
+  cartridge_remap(cpu);
+  ppu_invalidate_tiles(cpu);
+  blip_clear(&cpu->apu.blip[0]);
+  blip_clear(&cpu->apu.blip[1]);
+  return STATE_OK;
+}
@@ -0,0 +1,120 @@
+#include <emulation.h>
+#include <scheduler.h>
+#include <stdint.h>
+#include <timer.h>
+
+#define TAC_ENABLE 0x04
+
+/* TIMA counts falling edges of this bit of the internal counter. */
+static const uint8_t tac_bits[4] = {9, 3, 5, 7};
+
+static inline uint16_t counter(struct CPU *cpu) {
+  return (uint16_t)(cpu->cycles - cpu->timer.div_reset);
+}
+
+/* Falling edges of a selected bit are where the counter crosses a multiple
+ * of twice its value, so they are counted with a shift. */
+static inline uint8_t edge_shift(const struct Timer *timer) {
+  return tac_bits[timer->tac & 3] + 1;
+}
+
+static void timer_increment(struct CPU *cpu, uint64_t count) {
+  struct Timer *timer = &cpu->timer;
+
+  while (count > 0) {
+    const uint32_t room = 0x100 - timer->tima;
+    if (count < room) {
+      timer->tima += count;
+      return;
+    }
+    count -= room;
+    timer->tima = timer->tma;
+    request_interrupt(cpu, INT_TIMER);
+  }
+}
+
+/* Counts the edges between the last sync and time into TIMA. */
+static void timer_sync(struct CPU *cpu, uint64_t time) {
+  struct Timer *timer = &cpu->timer;
+
+  if (timer->tac & TAC_ENABLE) {
+    const uint8_t shift = edge_shift(timer);
+    timer_increment(cpu, ((time - timer->div_reset) >> shift) -
+                             ((timer->synced - timer->div_reset) >> shift));
+  }
+  timer->synced = time;
+}
+
+/* Schedules the edge that takes TIMA past 0xFF, or nothing while the timer
+ * is stopped. Called whenever TIMA, TAC or the counter change. */
+static void schedule_overflow(struct CPU *cpu) {
+  const struct Timer *timer = &cpu->timer;
+
+  if (!(timer->tac & TAC_ENABLE)) {
+    unschedule(cpu, SCHED_TIMER);
+    return;
+  }
+
+  const uint8_t shift = edge_shift(timer);
+  const uint64_t edge = ((timer->synced - timer->div_reset) >> shift) +
+                        (0x100 - timer->tima);
+  schedule(cpu, SCHED_TIMER, timer->div_reset + (edge << shift));
+}
+
+void timer_reset(struct CPU *cpu) {
+  struct Timer *timer = &cpu->timer;
+
+  timer->div_reset = cpu->cycles;
+  timer->synced = cpu->cycles;
+  timer->tima = 0;
+  timer->tma = 0;
+  timer->tac = 0;
+  unschedule(cpu, SCHED_TIMER);
+}
+
+void timer_event(struct CPU *cpu, uint64_t time) {
+  timer_sync(cpu, time);
+  schedule_overflow(cpu);
+}
+
+uint8_t timer_read(struct CPU *cpu, uint8_t reg) {
+  struct Timer *timer = &cpu->timer;
+
+  switch (reg) {
+  case 0x04:
+    return counter(cpu) >> 8;
+  case 0x05:
+    timer_sync(cpu, cpu->cycles);
+    return timer->tima;
+  case 0x06:
+    return timer->tma;
+  default:
+    return timer->tac | 0xF8;
+  }
+}
+
+void timer_write(struct CPU *cpu, uint8_t reg, uint8_t val) {
+  struct Timer *timer = &cpu->timer;
+
+  timer_sync(cpu, cpu->cycles);
+  switch (reg) {
+  case 0x04:
+    /* Resetting the counter is a falling edge if the selected bit was set. */
+    if ((timer->tac & TAC_ENABLE) &&
+        (counter(cpu) >> tac_bits[timer->tac & 3]) & 1) {
+      timer_increment(cpu, 1);
+    }
+    timer->div_reset = cpu->cycles;
+    break;
+  case 0x05:
+    timer->tima = val;
+    break;
+  case 0x06:
+    timer->tma = val;
+    return;
+  default:
+    timer->tac = val & 0x07;
+    break;
+  }
+  schedule_overflow(cpu);
+}